@@ -95,8 +95,8 @@ static void refresh_thread() {
         timevalue_t next = clock.source_time(1000);
         pages[page]->refresh_console(true);
 
-        // wait a second
-        timer.wait_until(next);
+        // wait a second, but it doesn't matter if it's a bit more
+        timer.wait_until(next, Hip::get().freq_tsc * 50ULL);
     }
 }
 
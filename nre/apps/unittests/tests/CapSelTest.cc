@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2012, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+
+#include <ipc/Service.h>
+#include <ipc/Connection.h>
+#include <ipc/ClientSession.h>
+#include <subsystem/ChildManager.h>
+#include <kobj/Pt.h>
+#include <stream/OStringStream.h>
+#include <utcb/UtcbFrame.h>
+#include <CPU.h>
+#include <cstring>
+
+#include "CapSelTest.h"
+
+using namespace nre;
+using namespace nre::test;
+
+static void test_churn();
+
+const TestCase capsel_churn = {
+    "Capability selectors - connect to two services alternately", test_churn
+};
+
+static const size_t ROUNDS = 100;
+static const char *names[] = {"churn-a", "churn-b"};
+static const char *srvname;
+
+PORTAL static void portal_name(capsel_t) {
+    UtcbFrameRef uf;
+    uf.clear();
+    uf << E_SUCCESS << String(srvname);
+}
+
+static int churn_service(int, char *argv[]) {
+    srvname = argv[1];
+    Service *srv = new Service(srvname, CPUSet(CPUSet::ALL), portal_name);
+    srv->start();
+    delete srv;
+    return 0;
+}
+
+static int churn_client(int, char *[]) {
+    // the selectors of the connections and sessions are reused. if they would still refer to
+    // the portals of the previous service, we would talk to the wrong one.
+    for(size_t i = 0; i < ROUNDS; ++i) {
+        const char *name = names[i % ARRAY_SIZE(names)];
+        Connection con(name);
+        ClientSession sess(con);
+        Pt pt(sess.caps() + CPU::current().log_id());
+        UtcbFrame uf;
+        pt.call(uf);
+        uf.check_reply();
+        String reply;
+        uf >> reply;
+        WVPASS(strcmp(reply.str(), name) == 0);
+    }
+    return 0;
+}
+
+static void test_churn() {
+    char cmdline[64];
+    Hip::mem_iterator self = Hip::get().mem_begin();
+    ChildManager *mng = new ChildManager();
+    // map the memory of the module
+    DataSpace *ds = new DataSpace(self->size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::R, self->addr);
+    Child::id_type srvs[ARRAY_SIZE(names)];
+    for(size_t i = 0; i < ARRAY_SIZE(names); ++i) {
+        OStringStream os(cmdline, sizeof(cmdline));
+        os << "churn_service " << names[i] << " provides=" << names[i];
+        ChildConfig cfg(0, cmdline);
+        cfg.entry(reinterpret_cast<uintptr_t>(churn_service));
+        srvs[i] = mng->load(ds->virt(), self->size, cfg);
+    }
+    {
+        ChildConfig cfg(0, "churn_client");
+        cfg.entry(reinterpret_cast<uintptr_t>(churn_client));
+        mng->load(ds->virt(), self->size, cfg);
+    }
+
+    // wait until the client is done and stop the services afterwards
+    while(mng->count() > ARRAY_SIZE(names))
+        mng->dead_sm().down();
+    for(size_t i = 0; i < ARRAY_SIZE(names); ++i)
+        mng->kill(srvs[i]);
+    while(mng->count() > 0)
+        mng->dead_sm().down();
+    delete ds;
+    delete mng;
+}
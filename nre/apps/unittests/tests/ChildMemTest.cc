@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2012, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+
+#include <subsystem/ChildMemory.h>
+
+#include "ChildMemTest.h"
+
+using namespace nre;
+using namespace nre::test;
+
+static void test_join();
+
+const TestCase childmem_join = {
+    "ChildMemory - add a dataspace multiple times", test_join
+};
+
+static void add(ChildMemory &cm, uintptr_t addr, capsel_t sel) {
+    cm.add(DataSpaceDesc(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW),
+           addr, ChildMemory::RW, sel);
+}
+
+static void test_join() {
+    const uintptr_t addr = 0x100000;
+    const size_t pg = ExecEnv::PAGE_SIZE;
+    ChildMemory cm;
+
+    // a child can join the same dataspace multiple times, i.e. we get the same selector again
+    add(cm, addr + pg * 0, 10);
+    add(cm, addr + pg * 2, 20);
+    add(cm, addr + pg * 4, 10);
+    add(cm, addr + pg * 6, 10);
+    WVPASSEQ(cm.find(10)->desc().virt(), addr + pg * 0);
+    WVPASSEQ(cm.find(20)->desc().virt(), addr + pg * 2);
+
+    // remove the first one; the others have to be found by selector and address
+    capsel_t sel = 0;
+    cm.remove_by_addr(addr + pg * 0, &sel);
+    WVPASSEQ(sel, static_cast<capsel_t>(10));
+    WVPASS(cm.find(10) != nullptr);
+    WVPASSEQ(cm.find_by_addr(addr + pg * 4)->cap(), static_cast<capsel_t>(10));
+    WVPASSEQ(cm.find_by_addr(addr + pg * 6)->cap(), static_cast<capsel_t>(10));
+
+    // remove one in the middle of the chain
+    add(cm, addr + pg * 8, 10);
+    cm.remove_by_addr(addr + pg * 6);
+    WVPASS(cm.find_by_addr(addr + pg * 6) == nullptr);
+
+    // now remove the rest by selector
+    cm.remove(10);
+    WVPASS(cm.find(10) != nullptr);
+    cm.remove(10);
+    WVPASS(cm.find(10) == nullptr);
+    WVPASS(cm.find_by_addr(addr + pg * 4) == nullptr);
+    WVPASS(cm.find_by_addr(addr + pg * 8) == nullptr);
+    bool caught = false;
+    try {
+        cm.remove(10);
+    }
+    catch(const ChildMemoryException&) {
+        caught = true;
+    }
+    WVPASS(caught);
+
+    // the other dataspace is still there
+    WVPASSEQ(cm.find(20)->desc().virt(), addr + pg * 2);
+    cm.remove(20);
+    WVPASS(cm.begin() == cm.end());
+}
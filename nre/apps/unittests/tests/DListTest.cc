@@ -106,4 +106,23 @@ static void test_dlist() {
     --it;
     WVPASS(&*it == &e2);
     WVPASS(it == l.begin());
+
+    l.insert(nullptr, &e1);
+    l.insert(&e2, &e3);
+    WVPASSEQ(l.length(), static_cast<size_t>(3));
+    it = l.begin();
+    WVPASS(&*it == &e1);
+    ++it;
+    WVPASS(&*it == &e2);
+    ++it;
+    WVPASS(&*it == &e3);
+    ++it;
+    WVPASS(it == l.end());
+    --it;
+    WVPASS(&*it == &e3);
+    --it;
+    WVPASS(&*it == &e2);
+    --it;
+    WVPASS(&*it == &e1);
+    WVPASS(it == l.begin());
 }
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2012, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <kobj/GlobalThread.h>
+#include <kobj/Sm.h>
+#include <ipc/MPSCProducer.h>
+#include <ipc/MPSCConsumer.h>
+#include <util/Util.h>
+#include <CPU.h>
+
+#include "MPSCTest.h"
+
+using namespace nre;
+using namespace nre::test;
+
+static const size_t ITEM_COUNT  = 10000;
+static const size_t BATCH_SIZE  = 8;
+static const size_t MAX_PRODS   = 16;
+
+struct Item {
+    size_t producer;
+    size_t seq;
+};
+
+static void test_mpsc();
+
+const TestCase mpsctest = {
+    "MPSC producer/consumer", test_mpsc
+};
+
+static MPSCProducer<Item> *prod;
+static Sm *done;
+
+static void producer(void*) {
+    size_t id = Thread::current()->get_tls<word_t>(Thread::TLS_PARAM);
+    Item items[BATCH_SIZE];
+    for(size_t seq = 0; seq < ITEM_COUNT; ) {
+        size_t count = Math::min(BATCH_SIZE, ITEM_COUNT - seq);
+        for(size_t i = 0; i < count; ++i) {
+            items[i].producer = id;
+            items[i].seq = seq + i;
+        }
+        size_t res = prod->produce_n(items, count);
+        // if the ring is full, give the consumer some time. the rest is sent in the next round
+        seq += res;
+        if(res < count)
+            Util::pause();
+    }
+    done->up();
+}
+
+static void test_mpsc() {
+    DataSpace ds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW);
+    Sm sm(0);
+    MPSCConsumer<Item> cons(ds, sm, true);
+    prod = new MPSCProducer<Item>(ds, sm, false);
+    done = new Sm(0);
+
+    // one producer per CPU, but at least two
+    size_t prods = Math::min(MAX_PRODS, Math::max<size_t>(2, CPU::count()));
+    size_t next[MAX_PRODS] = {0};
+    for(size_t i = 0; i < prods; ++i) {
+        GlobalThread *gt = GlobalThread::create(producer, i % CPU::count(), "mpsc-producer");
+        gt->set_tls<word_t>(Thread::TLS_PARAM, i);
+        gt->start();
+    }
+
+    // every producer has to arrive in order
+    Item items[BATCH_SIZE * 4];
+    size_t total = 0;
+    size_t calls = 0;
+    bool inorder = true;
+    uint64_t start = Util::tsc();
+    while(total < prods * ITEM_COUNT) {
+        size_t count = cons.consume_n(items, ARRAY_SIZE(items));
+        for(size_t i = 0; i < count; ++i) {
+            if(items[i].producer >= prods || items[i].seq != next[items[i].producer])
+                inorder = false;
+            else
+                next[items[i].producer]++;
+        }
+        total += count;
+        calls++;
+    }
+    uint64_t end = Util::tsc();
+
+    WVPASS(inorder);
+    WVPASSEQ(total, prods * ITEM_COUNT);
+    WVPRINT("Received " << total << " items from " << prods << " producers in " << calls << " calls");
+    WVPERF((end - start) / total, "cycles per item");
+
+    // the producers might still use the semaphore
+    for(size_t i = 0; i < prods; ++i)
+        done->down();
+    delete done;
+    delete prod;
+}
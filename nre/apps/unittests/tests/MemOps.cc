@@ -17,6 +17,7 @@
 #include <kobj/Pt.h>
 #include <utcb/UtcbFrame.h>
 #include <util/Profiler.h>
+#include <util/Math.h>
 #include <CPU.h>
 #include <cstdlib>
 
@@ -26,63 +27,146 @@ using namespace nre;
 using namespace nre::test;
 
 typedef void (*memop_func)(void *a, void *b, size_t len);
+typedef bool (*memop_check)(const void *a, const void *b, size_t len);
 
 static void test_memcpy();
+static void test_memmove();
 static void test_memset();
-static void do_test(const char *name, memop_func func);
+static void do_test(const char *name, memop_func func, memop_check check);
+static void check_overlap();
 
 const TestCase memcpytest = {
     "Memory operations", test_memcpy
 };
+const TestCase memmovetest = {
+    "Memory operations", test_memmove
+};
 const TestCase memsettest = {
     "Memory operations", test_memset
 };
 
-static const size_t AREA_SIZE   = 4096;
-static const uint TEST_COUNT    = 1000;
+// the sizes cover the byte-wise, the vector, the "rep movsb" and the non-temporal paths
+static const size_t SIZES[]     = {16, 64, 256, 1024, 4096, 16384, 65536, 512 * 1024};
+static const size_t AREA_SIZE   = 512 * 1024 + 64;
+static const size_t BYTES       = 4 * 1024 * 1024;
+static const uint MIN_COUNT     = 10;
+static const uint MAX_COUNT     = 1000;
+
+// the overlapping moves are checked around the block size of the vector loops and the threshold
+// at which they are used
+static const size_t MOVE_SIZES[]    = {
+    1, 15, 16, 17, 63, 64, 65, 127, 128, 129, 191, 192, 193, 255, 256, 257, 1023, 1024, 1025
+};
+static const size_t MOVE_OFFS[]     = {0, 1, 3, 8, 16};
+static const size_t MOVE_DISTS[]    = {1, 7, 8, 16, 63, 64, 65};
+static const size_t MOVE_AREA       = 1024 + 64 + 64;
 
 static void memcpy_func(void *a, void *b, size_t len) {
     memcpy(a, const_cast<const void*>(b), len);
 }
+static void memmove_func(void *a, void *, size_t len) {
+    // move the area up by one word, so that it overlaps and we have to copy backwards
+    memmove(reinterpret_cast<char*>(a) + sizeof(word_t), a, len);
+}
 static void memset_func(void *a, void *, size_t len) {
     memset(a, 0, len);
 }
 
+static bool memcpy_check(const void *a, const void *b, size_t len) {
+    return memcmp(a, b, len) == 0;
+}
+static bool memset_check(const void *a, const void *, size_t len) {
+    const char *p = reinterpret_cast<const char*>(a);
+    for(size_t i = 0; i < len; ++i) {
+        if(p[i] != 0)
+            return false;
+    }
+    return true;
+}
+
 static void test_memcpy() {
-    do_test("memcpy", memcpy_func);
+    do_test("memcpy", memcpy_func, memcpy_check);
+}
+static void test_memmove() {
+    do_test("memmove", memmove_func, nullptr);
+    check_overlap();
 }
 static void test_memset() {
-    do_test("memset", memset_func);
+    do_test("memset", memset_func, memset_check);
 }
 
-static void do_test(const char *name, memop_func func) {
-    void *mem = malloc(AREA_SIZE);
-    void *buf = malloc(AREA_SIZE);
-
-    {
-        WVPRINT("Testing aligned " << name << " with " << AREA_SIZE << " bytes");
-        AvgProfiler prof(TEST_COUNT);
-        for(uint i = 0; i < TEST_COUNT; ++i) {
-            prof.start();
-            func(buf, mem, AREA_SIZE);
-            prof.stop();
-        }
-        WVPERF(prof.avg(), " cycles");
-        WVPRINT("min: " << prof.min());
-        WVPRINT("max: " << prof.max());
+static void do_profile(const char *name, memop_func func, memop_check check,
+                       char *buf, char *mem, size_t size, size_t off) {
+    // do roughly the same amount of work for all sizes
+    uint count = Math::max<uint>(MIN_COUNT, Math::min<uint>(MAX_COUNT, BYTES / size));
+    WVPRINT("Testing " << (off ? "unaligned " : "aligned ") << name << " with " << size << " bytes");
+    AvgProfiler prof(count);
+    for(uint i = 0; i < count; ++i) {
+        prof.start();
+        func(buf + off, mem + off, size);
+        prof.stop();
     }
+    if(check)
+        WVPASS(check(buf + off, mem + off, size));
+    WVPERF(prof.avg(), " cycles");
+    WVPRINT("min: " << prof.min());
+    WVPRINT("max: " << prof.max());
+}
+
+static bool check_move(char *area, char *ref, size_t src, size_t dst, size_t size) {
+    for(size_t i = 0; i < MOVE_AREA; ++i)
+        area[i] = ref[i] = i * 7;
+    memmove(area + dst, area + src, size);
+
+    // the volatile prevents the compiler from turning that into a memmove call
+    volatile char *r = ref;
+    if(dst > src) {
+        for(size_t i = size; i-- > 0; )
+            r[dst + i] = r[src + i];
+    }
+    else {
+        for(size_t i = 0; i < size; ++i)
+            r[dst + i] = r[src + i];
+    }
+    return memcmp(area, ref, MOVE_AREA) == 0;
+}
 
-    {
-        WVPRINT("Testing unaligned " << name << " with " << AREA_SIZE << " bytes");
-        AvgProfiler prof(TEST_COUNT);
-        for(uint i = 0; i < TEST_COUNT; ++i) {
-            prof.start();
-            func(reinterpret_cast<char*>(buf) + 1, reinterpret_cast<char*>(mem) + 1, AREA_SIZE - 2);
-            prof.stop();
+static void check_overlap() {
+    char *area = reinterpret_cast<char*>(malloc(MOVE_AREA));
+    char *ref = reinterpret_cast<char*>(malloc(MOVE_AREA));
+    size_t failed = 0;
+    for(size_t s = 0; s < ARRAY_SIZE(MOVE_SIZES); ++s) {
+        for(size_t o = 0; o < ARRAY_SIZE(MOVE_OFFS); ++o) {
+            for(size_t d = 0; d < ARRAY_SIZE(MOVE_DISTS); ++d) {
+                size_t lo = MOVE_OFFS[o], hi = MOVE_OFFS[o] + MOVE_DISTS[d];
+                // move up (backwards copy) and down (forward copy)
+                if(!check_move(area, ref, lo, hi, MOVE_SIZES[s])) {
+                    WVPRINT("memmove of " << MOVE_SIZES[s] << " bytes from " << lo << " to " << hi
+                                          << " failed");
+                    failed++;
+                }
+                if(!check_move(area, ref, hi, lo, MOVE_SIZES[s])) {
+                    WVPRINT("memmove of " << MOVE_SIZES[s] << " bytes from " << hi << " to " << lo
+                                          << " failed");
+                    failed++;
+                }
+            }
         }
-        WVPERF(prof.avg(), " cycles");
-        WVPRINT("min: " << prof.min());
-        WVPRINT("max: " << prof.max());
+    }
+    WVPASSEQ(failed, static_cast<size_t>(0));
+    free(ref);
+    free(area);
+}
+
+static void do_test(const char *name, memop_func func, memop_check check) {
+    char *mem = reinterpret_cast<char*>(malloc(AREA_SIZE));
+    char *buf = reinterpret_cast<char*>(malloc(AREA_SIZE));
+    for(size_t i = 0; i < AREA_SIZE; ++i)
+        mem[i] = i;
+
+    for(size_t i = 0; i < ARRAY_SIZE(SIZES); ++i) {
+        do_profile(name, func, check, buf, mem, SIZES[i], 0);
+        do_profile(name, func, check, buf, mem, SIZES[i] - 2, 1);
     }
 
     free(buf);
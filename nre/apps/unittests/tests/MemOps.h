@@ -19,4 +19,5 @@
 #include <Test.h>
 
 extern const nre::test::TestCase memcpytest;
+extern const nre::test::TestCase memmovetest;
 extern const nre::test::TestCase memsettest;
@@ -17,6 +17,7 @@
 #include <kobj/Pt.h>
 #include <utcb/UtcbFrame.h>
 #include <util/Profiler.h>
+#include <RCU.h>
 #include <CPU.h>
 
 #include "Pingpong.h"
@@ -35,6 +36,11 @@ static const uint tries = 10000;
 PORTAL static void portal_empty(capsel_t) {
 }
 
+PORTAL static void portal_rcu(capsel_t) {
+    // that's what every portal of a service does to find the session
+    ScopedLock<RCULock> guard(&RCU::lock());
+}
+
 PORTAL static void portal_data(capsel_t) {
     UtcbFrameRef uf;
     try {
@@ -72,6 +78,34 @@ static void test_pingpong() {
         print_result(prof, (1 + 2) * tries + (1 + 2 + 3) * tries);
     }
 
+    {
+        Pt pt(ec, portal_rcu);
+        AvgProfiler prof(tries);
+        UtcbFrame uf;
+        for(uint i = 0; i < tries; i++) {
+            prof.start();
+            pt.call(uf);
+            prof.stop();
+        }
+        WVPRINT("Using portal_rcu:");
+        print_result(prof, (1 + 2) * tries + (1 + 2 + 3) * tries);
+    }
+
+    {
+        AvgProfiler prof(tries);
+        for(uint i = 0; i < tries; i++) {
+            prof.start();
+            {
+                ScopedLock<RCULock> guard(&RCU::lock());
+            }
+            prof.stop();
+        }
+        WVPRINT("RCU read section:");
+        WVPERF(prof.avg(), "cycles");
+        WVPRINT("min: " << prof.min());
+        WVPRINT("max: " << prof.max());
+    }
+
     {
         Pt pt(ec, portal_data);
         AvgProfiler prof(tries);
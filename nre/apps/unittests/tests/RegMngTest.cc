@@ -16,17 +16,29 @@
 
 #include <region/RegionManager.h>
 #include <util/ScopedPtr.h>
+#include <util/Profiler.h>
+#include <util/Random.h>
 
 #include "RegMngTest.h"
 
 using namespace nre;
 using namespace nre::test;
 
+#define PERF_BASE       0x10000000
+#define PERF_AREA       0x40000000
+#define PERF_PAGE       0x1000
+#define PERF_SLOTS      512
+#define PERF_ROUNDS     10000
+
 static void test_regmng();
+static void test_regmng_perf();
 
 const TestCase regmng = {
     "RegionManager", test_regmng
 };
+const TestCase regmng_perf = {
+    "RegionManager - fragmentation and latency", test_regmng_perf
+};
 
 void test_regmng() {
     uintptr_t addr1, addr2, addr3;
@@ -46,14 +58,16 @@ void test_regmng() {
 
         WVPASSEQ(rm->total_count(), static_cast<size_t>(0x6000));
         auto it = rm->begin();
-        WVPASSEQ(it->addr, static_cast<uintptr_t>(0x200000));
-        WVPASSEQ(it->size, static_cast<size_t>(0x1000));
-        ++it;
         WVPASSEQ(it->addr, static_cast<uintptr_t>(0x100000));
         WVPASSEQ(it->size, static_cast<size_t>(0x3000));
         ++it;
+        WVPASSEQ(it->addr, static_cast<uintptr_t>(0x200000));
+        WVPASSEQ(it->size, static_cast<size_t>(0x1000));
+        ++it;
         WVPASSEQ(it->addr, static_cast<uintptr_t>(0x280000));
         WVPASSEQ(it->size, static_cast<size_t>(0x2000));
+        ++it;
+        WVPASS(it == rm->end());
     }
 
     {
@@ -71,13 +85,101 @@ void test_regmng() {
         rm->free(addr2, 0x1000);
 
         auto it = rm->begin();
+        WVPASSEQ(it->addr, static_cast<uintptr_t>(0x100000));
+        WVPASSEQ(it->size, static_cast<size_t>(0x3000));
+        ++it;
         WVPASSEQ(it->addr, static_cast<uintptr_t>(0x200000));
         WVPASSEQ(it->size, static_cast<size_t>(0x1000));
         ++it;
         WVPASSEQ(it->addr, static_cast<uintptr_t>(0x280000));
         WVPASSEQ(it->size, static_cast<size_t>(0x2000));
         ++it;
+        WVPASS(it == rm->end());
+    }
+
+    {
+        ScopedPtr<RegionManager<>> rm(new RegionManager<>());
+        rm->free(0x100000, 0x10000);
+
+        // take parts from the beginning, the middle and the end
+        WVPASSEQ(rm->alloc_at(0x100000, 0x1000), static_cast<size_t>(0x1000));
+        WVPASSEQ(rm->alloc_at(0x108000, 0x2000), static_cast<size_t>(0x2000));
+        WVPASSEQ(rm->alloc_at(0x10F000, 0x2000), static_cast<size_t>(0x1000));
+        WVPASSEQ(rm->total_count(), static_cast<size_t>(0xC000));
+
+        // an aligned allocation leaves the space before it free
+        addr1 = rm->alloc(0x1000, 0x4000);
+        WVPASSEQ(addr1 & 0x3FFF, static_cast<uintptr_t>(0));
+        WVPASSEQ(rm->total_count(), static_cast<size_t>(0xB000));
+
+        // freeing everything merges it again
+        rm->free(addr1, 0x1000);
+        rm->free(0x100000, 0x1000);
+        rm->free(0x10F000, 0x1000);
+        rm->free(0x108000, 0x2000);
+        auto it = rm->begin();
         WVPASSEQ(it->addr, static_cast<uintptr_t>(0x100000));
-        WVPASSEQ(it->size, static_cast<size_t>(0x3000));
+        WVPASSEQ(it->size, static_cast<size_t>(0x10000));
+        ++it;
+        WVPASS(it == rm->end());
     }
 }
+
+static size_t random_size() {
+    // mostly small allocations with a few big ones in between
+    if(Random::get() % 16 == 0)
+        return (1 + Random::get() % 256) * PERF_PAGE;
+    return (1 + Random::get() % 16) * PERF_PAGE;
+}
+
+static void test_regmng_perf() {
+    static uintptr_t addrs[PERF_SLOTS];
+    static size_t sizes[PERF_SLOTS];
+    ScopedPtr<RegionManager<>> rm(new RegionManager<>());
+    AvgProfiler alloc(PERF_ROUNDS), free(PERF_ROUNDS);
+    rm->free(PERF_BASE, PERF_AREA);
+
+    // fill it first to measure the steady state
+    Random::init(0x12345);
+    for(size_t i = 0; i < PERF_SLOTS; ++i) {
+        sizes[i] = random_size();
+        addrs[i] = rm->alloc(sizes[i]);
+    }
+    for(size_t i = 0; i < PERF_ROUNDS; ++i) {
+        size_t slot = Random::get() % PERF_SLOTS;
+
+        free.start();
+        rm->free(addrs[slot], sizes[slot]);
+        free.stop();
+
+        sizes[slot] = random_size();
+        alloc.start();
+        addrs[slot] = rm->alloc(sizes[slot]);
+        alloc.stop();
+    }
+
+    size_t regions = 0, largest = 0;
+    for(auto it = rm->begin(); it != rm->end(); ++it) {
+        regions++;
+        largest = Math::max(largest, it->size);
+    }
+    size_t total = rm->total_count();
+    WVPRINT("Free regions: " << regions);
+    WVPRINT("Largest free region: " << largest << " of " << total << " units");
+    WVPERF(100 - (largest * 100) / total, "% fragmentation");
+    WVPERF(alloc.avg(), "cycles per alloc");
+    WVPRINT("min: " << alloc.min());
+    WVPRINT("max: " << alloc.max());
+    WVPERF(free.avg(), "cycles per free");
+    WVPRINT("min: " << free.min());
+    WVPRINT("max: " << free.max());
+
+    // everything has to be merged again
+    for(size_t i = 0; i < PERF_SLOTS; ++i)
+        rm->free(addrs[i], sizes[i]);
+    auto it = rm->begin();
+    WVPASSEQ(it->addr, static_cast<uintptr_t>(PERF_BASE));
+    WVPASSEQ(it->size, static_cast<size_t>(PERF_AREA));
+    ++it;
+    WVPASS(it == rm->end());
+}
@@ -19,3 +19,4 @@
 #include <Test.h>
 
 extern const nre::test::TestCase regmng;
+extern const nre::test::TestCase regmng_perf;
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2012, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <util/TimeoutList.h>
+#include <util/Profiler.h>
+#include <util/Random.h>
+
+#include "TimeoutListTest.h"
+
+#define TEST_ENTRIES        32
+#define TEST_ROUNDS         1000
+#define PERF_ENTRIES        512
+#define PERF_ROUNDS         10000
+
+using namespace nre;
+using namespace nre::test;
+
+typedef TimeoutList<TEST_ENTRIES, void> TestList;
+typedef TimeoutList<TEST_ENTRIES, void, TimeoutHeap<TEST_ENTRIES> > TestHeap;
+typedef TimeoutList<PERF_ENTRIES, void> PerfList;
+typedef TimeoutList<PERF_ENTRIES, void, TimeoutHeap<PERF_ENTRIES> > PerfHeap;
+
+static void test_order();
+static void test_perf();
+template<class TL>
+static void test_drain(TL *tl);
+template<class TL>
+static void perf(const char *name, TL *tl);
+
+const TestCase timeoutlist_order = {
+    "TimeoutList - sorted list and heap deliver timeouts in order", test_order
+};
+const TestCase timeoutlist_perf = {
+    "TimeoutList - performance of sorted list and heap", test_perf
+};
+
+static void test_order() {
+    TestList *list = new TestList();
+    TestHeap *heap = new TestHeap();
+    size_t nrs[TEST_ENTRIES - 1];
+
+    for(size_t i = 0; i < TEST_ENTRIES - 1; ++i) {
+        nrs[i] = list->alloc();
+        WVPASSEQ(heap->alloc(), nrs[i]);
+    }
+    // there is no free slot anymore
+    bool caught = false;
+    try {
+        heap->alloc();
+    }
+    catch(const TimeoutListException&) {
+        caught = true;
+    }
+    WVPASS(caught);
+
+    // request, move and cancel timeouts randomly. both have to agree on the earliest one.
+    Random::init(0x12345);
+    for(size_t i = 0; i < TEST_ROUNDS; ++i) {
+        size_t nr = nrs[Random::get() % (TEST_ENTRIES - 1)];
+        if(Random::get() % 4 == 0) {
+            WVPASSEQ(heap->cancel(nr), list->cancel(nr));
+        }
+        else {
+            timevalue_t to = 1 + Random::get();
+            WVPASSEQ(heap->request(nr, to), list->request(nr, to));
+        }
+        WVPASSEQ(heap->timeout(), list->timeout());
+    }
+    test_drain(list);
+    test_drain(heap);
+
+    // the freed entries have to be reusable
+    WVPASS(heap->dealloc(nrs[3]));
+    WVPASS(!heap->dealloc(nrs[3]));
+    WVPASSEQ(heap->alloc(), nrs[3]);
+
+    delete heap;
+    delete list;
+}
+
+template<class TL>
+static void test_drain(TL *tl) {
+    timevalue_t last = 0;
+    size_t nr;
+    while((nr = tl->trigger(~0ULL - 1))) {
+        WVPASS(tl->timeout() >= last);
+        last = tl->timeout();
+        tl->cancel(nr);
+    }
+    WVPASSEQ(tl->timeout(), static_cast<timevalue_t>(~0ULL));
+}
+
+static void test_perf() {
+    PerfList *list = new PerfList();
+    PerfHeap *heap = new PerfHeap();
+    perf("Sorted list:", list);
+    perf("Heap:", heap);
+    delete heap;
+    delete list;
+}
+
+template<class TL>
+static void perf(const char *name, TL *tl) {
+    AvgProfiler req(PERF_ROUNDS), can(PERF_ROUNDS);
+    for(size_t i = 0; i < PERF_ENTRIES - 1; ++i)
+        tl->alloc();
+
+    // fill it with random timeouts first to measure the steady state
+    Random::init(0x12345);
+    for(size_t i = 1; i < PERF_ENTRIES; ++i)
+        tl->request(i, Random::get());
+    for(size_t i = 0; i < PERF_ROUNDS; ++i) {
+        size_t nr = 1 + Random::get() % (PERF_ENTRIES - 1);
+        timevalue_t to = Random::get();
+
+        can.start();
+        tl->cancel(nr);
+        can.stop();
+
+        req.start();
+        tl->request(nr, to);
+        req.stop();
+    }
+
+    WVPRINT(name);
+    WVPERF(req.avg(), "cycles per request");
+    WVPRINT("min: " << req.min());
+    WVPRINT("max: " << req.max());
+    WVPERF(can.avg(), "cycles per cancel");
+    WVPRINT("min: " << can.min());
+    WVPRINT("max: " << can.max());
+}
@@ -29,6 +29,7 @@ using namespace nre::test;
 static void test_in_order();
 static void test_rev_order();
 static void test_rand_order();
+static void test_floor();
 static void test_perf();
 static void test_add_and_rem(int *vals);
 static void print_perf(const char *name, AvgProfiler &prof);
@@ -42,6 +43,9 @@ const TestCase treaptest_revorder = {
 const TestCase treaptest_randorder = {
     "Treap - add and remove regions with addresses in rand order", test_rand_order
 };
+const TestCase treaptest_floor = {
+    "Treap - find nodes with the largest key less than or equal to a value", test_floor
+};
 const TestCase treaptest_perf = {
     "Treap - performance", test_perf
 };
@@ -81,6 +85,34 @@ static void test_rand_order() {
     test_add_and_rem(vals);
 }
 
+static void test_floor() {
+    static MyNode *nodes[TEST_NODE_COUNT];
+    Treap<MyNode> tree;
+    MyNode *node;
+
+    // use the keys 10, 20, ... in a non-sorted order
+    for(size_t i = 0; i < TEST_NODE_COUNT; i++) {
+        int key = ((i * 7) % TEST_NODE_COUNT + 1) * 10;
+        nodes[i] = new MyNode(key, i);
+        tree.insert(nodes[i]);
+    }
+
+    node = tree.find_floor(5);
+    WVPASSEQPTR(node, static_cast<MyNode*>(nullptr));
+    for(size_t i = 0; i < TEST_NODE_COUNT; i++) {
+        int key = nodes[i]->key();
+        node = tree.find_floor(key);
+        WVPASSEQPTR(node, nodes[i]);
+        node = tree.find_floor(key + 9);
+        WVPASSEQPTR(node, nodes[i]);
+    }
+
+    for(size_t i = 0; i < TEST_NODE_COUNT; i++) {
+        tree.remove(nodes[i]);
+        delete nodes[i];
+    }
+}
+
 static void test_perf() {
     Treap<MyNode> tree;
     MyNode **nodes = new MyNode *[PERF_NODE_COUNT];
@@ -21,4 +21,5 @@
 extern const nre::test::TestCase treaptest_inorder;
 extern const nre::test::TestCase treaptest_revorder;
 extern const nre::test::TestCase treaptest_randorder;
+extern const nre::test::TestCase treaptest_floor;
 extern const nre::test::TestCase treaptest_perf;
@@ -17,6 +17,7 @@
 #include <kobj/Pt.h>
 #include <utcb/UtcbFrame.h>
 #include <util/Profiler.h>
+#include <util/DMA.h>
 #include <CPU.h>
 
 #include "UtcbTest.h"
@@ -25,8 +26,10 @@ using namespace nre;
 using namespace nre::test;
 
 PORTAL static void portal_test(capsel_t);
+PORTAL static void portal_dma(capsel_t);
 static void test_nesting();
 static void test_perf();
+static void test_dma_perf();
 
 const TestCase utcbnest = {
     "Utcb nesting", test_nesting
@@ -34,7 +37,12 @@ const TestCase utcbnest = {
 const TestCase utcbperf = {
     "Utcb performance", test_perf
 };
+const TestCase utcbdmaperf = {
+    "Utcb performance of DMA descriptor lists", test_dma_perf
+};
 static const uint tries = 100000;
+static const size_t MAX_DESCS = 64;
+typedef DMADescList<MAX_DESCS> dma_type;
 
 static void portal_test(capsel_t) {
     UtcbFrameRef uf;
@@ -56,6 +64,26 @@ static void portal_test(capsel_t) {
     }
 }
 
+static void portal_dma(capsel_t) {
+    UtcbFrameRef uf;
+    try {
+        bool raw;
+        dma_type dma;
+        uf >> raw;
+        if(raw)
+            uf.read_raw(dma);
+        else
+            uf >> dma;
+        uf.finish_input();
+        uf << dma.count();
+    }
+    catch(const Exception &e) {
+        Serial::get() << e;
+        WVPASS(false);
+        uf.clear();
+    }
+}
+
 static void test_nesting() {
     int a, b, c;
     LocalThread *ec = LocalThread::create(CPU::current().log_id());
@@ -152,3 +180,45 @@ static void test_perf() {
         WVPRINT("max: " << prof.max());
     }
 }
+
+static void perform_dma_test(Pt &pt, size_t descs, bool raw) {
+    AvgProfiler prof(tries);
+    dma_type dma;
+    for(size_t i = 0; i < descs; ++i)
+        dma.push(DMADesc(i * ExecEnv::PAGE_SIZE, ExecEnv::PAGE_SIZE));
+
+    size_t words = 0;
+    for(uint i = 0; i < tries; i++) {
+        prof.start();
+        {
+            UtcbFrame uf;
+            uf << raw;
+            if(raw)
+                uf.write_raw(dma);
+            else
+                uf << dma;
+            words = uf.untyped();
+            pt.call(uf);
+            size_t count;
+            uf >> count;
+        }
+        prof.stop();
+    }
+
+    WVPRINT((raw ? "Raw" : "Marshalled") << " list with " << descs << " descriptors ("
+                                         << (words * sizeof(word_t)) << " bytes):");
+    WVPERF(prof.avg(), "cycles");
+    WVPRINT("min: " << prof.min());
+    WVPRINT("max: " << prof.max());
+}
+
+static void test_dma_perf() {
+    LocalThread *ec = LocalThread::create(CPU::current().log_id());
+    Pt pt(ec, portal_dma);
+
+    size_t descs[] = {1, 4, 16, MAX_DESCS};
+    for(size_t i = 0; i < ARRAY_SIZE(descs); ++i) {
+        perform_dma_test(pt, descs[i], true);
+        perform_dma_test(pt, descs[i], false);
+    }
+}
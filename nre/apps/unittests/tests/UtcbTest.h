@@ -20,3 +20,4 @@
 
 extern const nre::test::TestCase utcbnest;
 extern const nre::test::TestCase utcbperf;
+extern const nre::test::TestCase utcbdmaperf;
@@ -21,6 +21,7 @@
 #include "tests/DelegatePerf.h"
 #include "tests/CatchEx.h"
 #include "tests/SharedMemory.h"
+#include "tests/MPSCTest.h"
 #include "tests/DataSpaceTest.h"
 #include "tests/SListTest.h"
 #include "tests/DListTest.h"
@@ -28,8 +29,11 @@
 #include "tests/RegMngTest.h"
 #include "tests/MaskFieldTest.h"
 #include "tests/TreapTest.h"
+#include "tests/ChildMemTest.h"
+#include "tests/TimeoutListTest.h"
 #include "tests/SortedSListTest.h"
 #include "tests/PingpongXPd.h"
+#include "tests/CapSelTest.h"
 #include "tests/MemOps.h"
 #include "tests/ThreadsTest.h"
 #include "tests/OStreamTest.h"
@@ -39,14 +43,17 @@ using namespace nre::test;
 
 const TestCase testcases[] = {
     memcpytest,
+    memmovetest,
     memsettest,
     threads,
     pingpong,
     pingpongxpd,
+    capsel_churn,
     catchex,
     delegateperf,
     utcbnest,
     utcbperf,
+    utcbdmaperf,
     dstest,
     slisttest,
     sortedslisttest,
@@ -55,12 +62,18 @@ const TestCase testcases[] = {
     cyclertest2,
     cyclertest3,
     regmng,
+    regmng_perf,
     maskfield,
     sharedmem,
+    mpsctest,
     treaptest_inorder,
     treaptest_revorder,
     treaptest_randorder,
+    treaptest_floor,
     treaptest_perf,
+    childmem_join,
+    timeoutlist_order,
+    timeoutlist_perf,
     ostream_writef,
     ostream_strops,
 };
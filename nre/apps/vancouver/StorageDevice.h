@@ -27,7 +27,8 @@ class StorageDevice {
 public:
     explicit StorageDevice(DBus<MessageDiskCommit> &bus, nre::DataSpace &guestmem,
                            nre::Connection &con, size_t no)
-        : _no(no), _bus(bus), _con(con), _sess(_con, guestmem, no) {
+        : _no(no), _bus(bus), _con(con), _sess(_con, guestmem, no), _queued(false),
+          _next() {
         char buffer[32];
         nre::OStringStream os(buffer, sizeof(buffer));
         os << "vmm-storage-" << no;
@@ -42,26 +43,71 @@ public:
     }
     void read(nre::Storage::tag_type tag, nre::Storage::sector_type sector,
               const nre::Storage::dma_type *dma) {
-        _sess.read(tag, sector, *dma);
+        // prefer the submission ring and fall back to a portal call if it's full
+        if(_sess.enqueue_read(tag, sector, *dma))
+            queued();
+        else {
+            _sess.submit();
+            _sess.read(tag, sector, *dma);
+        }
     }
     void write(nre::Storage::tag_type tag, nre::Storage::sector_type sector,
                const nre::Storage::dma_type *dma) {
-        _sess.write(tag, sector, *dma);
+        if(_sess.enqueue_write(tag, sector, *dma))
+            queued();
+        else {
+            _sess.submit();
+            _sess.write(tag, sector, *dma);
+        }
     }
     void flush_cache(nre::Storage::tag_type tag) {
-        _sess.flush(tag);
+        if(_sess.enqueue_flush(tag))
+            queued();
+        else {
+            _sess.submit();
+            _sess.flush(tag);
+        }
+    }
+
+    /**
+     * Hands the requests that have been queued since the last call over to the storage service,
+     * i.e. notifies it once per device instead of once per request. This has to be called at the
+     * end of every globalsm section that might send a MessageDisk (VM exits, timeouts, input,
+     * completions), so that all commands issued at once are submitted as one batch. The caller
+     * has to hold globalsm.
+     */
+    static void submit_all() {
+        while(_pending) {
+            StorageDevice *sd = _pending;
+            _pending = sd->_next;
+            sd->_next = nullptr;
+            sd->_queued = false;
+            sd->_sess.submit();
+        }
     }
 
 private:
+    void queued() {
+        if(!_queued) {
+            _queued = true;
+            _next = _pending;
+            _pending = this;
+        }
+    }
+
     static void thread(void*) {
         StorageDevice *sd = nre::Thread::current()->get_tls<StorageDevice*>(nre::Thread::TLS_PARAM);
         while(1) {
             nre::Storage::Packet *pk = sd->_sess.consumer().get();
-            // the status isn't used anyway
+            // errors of queued requests are reported via the status
             {
                 nre::ScopedLock<nre::UserSm> guard(&globalsm);
-                MessageDiskCommit msg(sd->_no, pk->tag, MessageDisk::DISK_OK);
+                MessageDiskCommit msg(sd->_no, pk->tag,
+                                      pk->status == 0 ? MessageDisk::DISK_OK
+                                                      : MessageDisk::DISK_STATUS_DEVICE);
                 sd->_bus.send(msg);
+                // the completion might have caused new requests
+                submit_all();
             }
             sd->_sess.consumer().next();
         }
@@ -71,4 +117,7 @@ private:
     DBus<MessageDiskCommit> &_bus;
     nre::Connection &_con;
     nre::StorageSession _sess;
+    bool _queued;
+    StorageDevice *_next;
+    static StorageDevice *_pending;
 };
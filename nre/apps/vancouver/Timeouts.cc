@@ -20,6 +20,7 @@
 
 #include "bus/profile.h"
 #include "Timeouts.h"
+#include "StorageDevice.h"
 
 using namespace nre;
 
@@ -51,6 +52,8 @@ void Timeouts::trigger() {
         _mb.bus_timeout.send(msg);
     }
     program();
+    // the devices might have issued disk requests
+    StorageDevice::submit_all();
 }
 
 void Timeouts::program() {
@@ -79,6 +79,7 @@ void VCPUBackend::handle_io(bool is_in, unsigned io_order, unsigned port) {
         ScopedLock<UserSm> guard(&globalsm);
         if(!vcpu->executor.send(msg, true))
             Util::panic("nobody to execute %s at %x:%x\n", __func__, msg.cpu->cs.sel, msg.cpu->eip);
+        StorageDevice::submit_all();
     }
     /* TODO if(service_events && !msg.consumed)
        service_events->send_event(*utcb,EventsProtocol::EVENT_UNSERVED_IOACCESS,sizeof(port),
@@ -126,9 +127,12 @@ void VCPUBackend::handle_vcpu(capsel_t pid, bool skip, CpuMessage::Type type) {
                         pid);
     }
     msg.cpu->mtd = msg.mtr_out;
+
+    // hand all disk requests of this exit over at once
+    StorageDevice::submit_all();
 }
 
-Crd VCPUBackend::lookup(uintptr_t base, size_t size, uintptr_t hotspot) {
+Crd VCPUBackend::lookup(uintptr_t base, size_t size, uintptr_t hotspot, uintptr_t guestbase) {
     Crd crd((base + hotspot) >> ExecEnv::PAGE_SHIFT, Math::next_pow2_shift(size), Crd::MEM);
     Crd res = Syscalls::lookup(crd);
     if(res.is_null()) {
@@ -138,13 +142,15 @@ Crd VCPUBackend::lookup(uintptr_t base, size_t size, uintptr_t hotspot) {
         assert(!res.is_null());
     }
 
-    // restrict it to a region that fits into [start, start+size)
+    // restrict it to a region that fits into [start, start+size). additionally, the guest address
+    // has to be aligned in the same way. otherwise the kernel can't use superpages for it.
     // XXX avoid the loop
     for(int i = res.order(); i >= 0; i--) {
-        Crd x(((base + hotspot) & ~((1 << (i + ExecEnv::PAGE_SHIFT)) - 1)) >> ExecEnv::PAGE_SHIFT, i,
-              res.attr());
+        uintptr_t blocksize = static_cast<uintptr_t>(1) << (i + ExecEnv::PAGE_SHIFT);
+        Crd x(((base + hotspot) & ~(blocksize - 1)) >> ExecEnv::PAGE_SHIFT, i, res.attr());
         uintptr_t start = x.offset() << ExecEnv::PAGE_SHIFT;
-        if((start >= base) && (start + (1 << (ExecEnv::PAGE_SHIFT + x.order()))) <= (base + size))
+        if((start >= base) && (start + blocksize <= base + size) &&
+           ((start - base + guestbase) & (blocksize - 1)) == 0)
             return x;
     }
     return res;
@@ -163,7 +169,7 @@ bool VCPUBackend::handle_memory(bool need_unmap) {
         uintptr_t hostaddr = reinterpret_cast<uintptr_t>(msg.ptr);
         uintptr_t guestbase = msg.start_page << ExecEnv::PAGE_SHIFT;
         uintptr_t hotspot = uf->qual[1] - guestbase;
-        Crd own = lookup(hostaddr, msg.count << ExecEnv::PAGE_SHIFT, hotspot);
+        Crd own = lookup(hostaddr, msg.count << ExecEnv::PAGE_SHIFT, hotspot, guestbase);
 
         if(need_unmap)
             CapRange(own.offset(), 1 << own.order(), Crd::MEM_ALL).revoke(false);
@@ -64,7 +64,7 @@ private:
 
     static void handle_io(bool is_in, unsigned io_order, unsigned port);
     static void handle_vcpu(capsel_t pid, bool skip, CpuMessage::Type type);
-    static nre::Crd lookup(uintptr_t base, size_t size, uintptr_t hotspot);
+    static nre::Crd lookup(uintptr_t base, size_t size, uintptr_t hotspot, uintptr_t guestbase);
     static bool handle_memory(bool need_unmap);
 
     static void force_invalid_gueststate_amd(nre::UtcbExcFrameRef &uf);
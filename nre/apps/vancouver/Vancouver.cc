@@ -33,6 +33,7 @@ static size_t ncpu = 1;
 static DataSpace *guest_mem = nullptr;
 static size_t guest_size = 0;
 nre::UserSm globalsm(0);
+StorageDevice *StorageDevice::_pending;
 
 PARAM_ALIAS(PC_PS2, "an alias to create an PS2 compatible PC",
             " mem:0,0xa0000 mem:0x100000 ioio nullio:0x80 pic:0x20,,0x4d0 pic:0xa0,2,0x4d1"
@@ -47,7 +48,8 @@ PARAM_HANDLER(ncpu, "ncpu - change the number of vcpus that are created") {
 PARAM_HANDLER(m, "m - specify the amount of memory for the guest in MiB") {
     guest_size = argv[0] * 1024 * 1024;
     guest_mem = new DataSpace(guest_size, DataSpaceDesc::ANONYMOUS,
-                              DataSpaceDesc::RWX | DataSpaceDesc::BIGPAGES, 0, 0,
+                              DataSpaceDesc::RWX | DataSpaceDesc::BIGPAGES |
+                              DataSpaceDesc::HUGE | DataSpaceDesc::ZEROED, 0, 0,
                               Math::next_pow2_shift(ExecEnv::BIG_PAGE_SIZE) - ExecEnv::PAGE_SHIFT);
 }
 PARAM_HANDLER(vcpus, " vcpus - instantiate the vcpus defined with 'ncpu'") {
@@ -208,6 +210,8 @@ bool Vancouver::receive(MessageHostOp &msg) {
 
         case MessageHostOp::OP_VCPU_BLOCK: {
             VCPUBackend *v = reinterpret_cast<VCPUBackend*>(msg.value);
+            // don't let the requests wait until we're woken up again
+            StorageDevice::submit_all();
             globalsm.up();
             v->sm().down();
             globalsm.down();
@@ -371,6 +375,7 @@ void Vancouver::keyboard_thread(void*) {
         ScopedLock<UserSm> guard(&globalsm);
         MessageInput msg(0x10000, pk.scancode | pk.flags);
         vc->_mb.bus_input.send(msg);
+        StorageDevice::submit_all();
     }
 }
 
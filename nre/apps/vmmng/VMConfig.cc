@@ -45,8 +45,12 @@ Child::id_type VMConfig::start(ChildManager &cm, size_t console, cpu_t cpu) {
 
     VMChildConfig cfg(_mods, args, cpu);
     Hip::mem_iterator mod = get_module(first->name());
-    DataSpace ds(mod->size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::R, mod->addr);
-    return cm.load(ds.virt(), mod->size, cfg);
+    // the segments are mapped from here into the VM, but only with the rights we have. so, we
+    // need X as well for the text
+    if(!_elf)
+        _elf = new DataSpace(mod->size, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RX, mod->addr);
+    cfg.share_segments(true);
+    return cm.load(_elf->virt(), mod->size, cfg);
 }
 
 Hip::mem_iterator VMConfig::get_module(const String &name) {
@@ -71,10 +71,11 @@ class VMConfig : public nre::SListItem {
 public:
     explicit VMConfig(uintptr_t phys, size_t size, const char *name)
         : nre::SListItem(), _ds(size, nre::DataSpaceDesc::ANONYMOUS, nre::DataSpaceDesc::R, phys),
-          _name(name), _mods() {
+          _name(name), _mods(), _elf() {
         find_mods(size);
     }
     ~VMConfig() {
+        delete _elf;
         for(auto it = _mods.begin(); it != _mods.end(); ) {
             auto old = it++;
             delete &*old;
@@ -97,4 +98,6 @@ private:
     nre::DataSpace _ds;
     const char *_name;
     nre::SList<Module> _mods;
+    // the ELF file of the first module. we keep it to share the segments among the VMs
+    nre::DataSpace *_elf;
 };
@@ -18,10 +18,12 @@
 
 #include <kobj/Thread.h>
 #include <kobj/UserSm.h>
+#include <arch/SpinLock.h>
 #include <collection/SList.h>
 #include <util/ScopedLock.h>
 #include <util/Sync.h>
 #include <util/Util.h>
+#include <Hip.h>
 
 /**
  * Usage:
@@ -33,10 +35,11 @@
  * RCU::invalidate(ptr). This is important because the method RCU::invalidate() is based on the
  * assumption that whenever an object is invalidated, there is NO way anymore to get access to it.
  *
- * Please note that RCU::invalidate() doesn't ensure that all objects are deleted. That is, only
- * objects that are already safe to delete, are deleted. This way, there is no busy-waiting
- * going on until the deletion is possible. If that is important for you, you can use RCU::gc(true)
- * to force the method to wait until all objects can be deleted.
+ * Please note that RCU::invalidate() doesn't ensure that the object is deleted immediately. That is,
+ * only objects that are already safe to delete, are deleted. The others are deleted by a reclaimer
+ * thread in the background. This way, there is no busy-waiting going on until the deletion is
+ * possible. If that is important for you, you can use RCU::gc(true) to force the method to wait
+ * until all objects can be deleted.
  */
 
 /*
@@ -120,6 +123,11 @@ class RCU;
  *   ScopedLock<RCULock> guard(&RCU::lock());
  *   // do stuff
  * }
+ *
+ * Entering a read section fences the update of the counter against the loads in the section. That
+ * is, if a reader can still load a pointer to an object, the updater will see the reader in its
+ * read section when it looks at the counters after the pointer has been removed (see
+ * RCU::collect_objects()).
  */
 class RCULock {
 public:
@@ -127,21 +135,38 @@ public:
     }
 
     void down() {
-        Thread *cur = Thread::current();
+        enter(Thread::current());
+    }
+    void up() {
+        leave(Thread::current());
+    }
+
+    /**
+     * Enters a read section for the given thread, which has to be the current one.
+     *
+     * @param cur the current thread
+     */
+    static void enter(Thread *cur) {
         uint32_t counter = cur->_rcu_counter;
         // update version-counter if we're entering a critical section
         if(!(counter & 0xFFFF))
             counter += 0x10000;
         // always update the nested-counter
         counter++;
-        // ensure that the counter-increase is written before anything else in the critical section
+        // ensure that the counter-increase is globally visible before we load anything in the
+        // critical section. a compiler barrier is not sufficient, because the store might still
+        // sit in the store buffer while we load a pointer that the updater has already removed.
         cur->_rcu_counter = counter;
-        Sync::memory_barrier();
+        Sync::memory_fence();
     }
-    void up() {
+    /**
+     * Leaves a read section for the given thread, which has to be the current one.
+     *
+     * @param cur the current thread
+     */
+    static void leave(Thread *cur) {
         // ensure that everything in the critical section is written before the counter is increased
         Sync::memory_barrier();
-        Thread *cur = Thread::current();
         cur->_rcu_counter--;
     }
 
@@ -150,6 +175,27 @@ private:
     RCULock& operator=(const RCULock&);
 };
 
+/**
+ * The specialization for RCU read sections, which determines the current thread only once.
+ * Since every portal of a service uses it, it is worth to save that.
+ */
+template<>
+class ScopedLock<RCULock> {
+public:
+    explicit ScopedLock(RCULock *) : _cur(Thread::current()) {
+        RCULock::enter(_cur);
+    }
+    ~ScopedLock() {
+        RCULock::leave(_cur);
+    }
+
+private:
+    ScopedLock(const ScopedLock&);
+    ScopedLock& operator=(const ScopedLock&);
+
+    Thread *_cur;
+};
+
 /**
  * The base-class for all objects that are handled by RCU
  */
@@ -158,12 +204,11 @@ class RCUObject {
 
     enum State {
         VALID,
-        INVALID,
-        DELETABLE
+        INVALID
     };
 
 public:
-    explicit RCUObject() : _state(VALID), _next(nullptr) {
+    explicit RCUObject() : _state(VALID), _epoch(), _next(nullptr) {
     }
     virtual ~RCUObject() {
     }
@@ -174,71 +219,78 @@ public:
 
 private:
     State _state;
+    // the grace period in which the object has been invalidated
+    size_t _epoch;
     RCUObject *_next;
 };
 
 class RCU {
+    /**
+     * The threads that run on one CPU
+     */
+    struct ThreadList {
+        SpinLock lock;
+        SList<Thread> ecs;
+    };
+
 public:
     /**
      * Adds the given Thread to the list of known Threads. Will be called by the Thread class
      * automatically.
      */
     static void add(Thread *ec) {
-        ScopedLock<UserSm> guard(&_ecsm);
-        _ecs.append(ec);
+        ThreadList &list = _threads[ec->cpu()];
+        ScopedLock<SpinLock> guard(&list.lock);
+        // the thread can't access objects that have been invalidated before it was created. so,
+        // it's fine to take its current state as the snapshot.
+        ec->_rcu_snapshot = ec->_rcu_counter;
+        list.ecs.append(ec);
     }
     /**
      * Removes the given thread from the list of known Threads. Will be called by the Thread class
      * automatically.
      */
     static void remove(Thread *ec) {
-        ScopedLock<UserSm> guard(&_ecsm);
-        _ecs.remove(ec);
+        ThreadList &list = _threads[ec->cpu()];
+        ScopedLock<SpinLock> guard(&list.lock);
+        list.ecs.remove(ec);
     }
 
     /**
      * Marks the given object as deletable. It assumes that you already made sure that nobody can
      * get access to it anymore, i.e. that there is no pointer to that object anymore.
-     * The method will also delete objects from previous invalidate() calls, if it is now safe to
-     * delete them.
+     * This is the equivalent of call_rcu(): the object is deleted as soon as it is safe. Objects
+     * that can't be deleted immediately are deleted by a reclaimer thread in the background, which
+     * is started on demand.
      */
     static void invalidate(RCUObject *o) {
-        ScopedLock<UserSm> guard(&_sm);
-        o->_state = RCUObject::INVALID;
-        o->_next = _objs;
-        _objs = o;
-
-        // check if all Ecs have left the critical section or entered it another time since the
-        // last invalidate call. if so, the last invalidated object is deletable (and all following
-        // ones as well)
-        if(o->_next && deletable()) {
-            o->_next->_state = RCUObject::DELETABLE;
-            delete_objects();
+        RCUObject *dead;
+        bool pending;
+        {
+            ScopedLock<UserSm> guard(&_sm);
+            o->_state = RCUObject::INVALID;
+            o->_epoch = _epoch;
+            o->_next = _objs;
+            _objs = o;
+            dead = advance();
+            pending = _objs != nullptr;
         }
-
-        store_versions();
+        // note that we delete the objects without holding the lock, because the destructors might
+        // want to acquire locks that are held while calling invalidate()
+        delete_objects(dead);
+        if(pending)
+            notify_reclaimer();
     }
 
     /**
      * Performs a garbage-collection. That is, all objects that are safe to delete, are deleted now.
      * If you set force to true, the method uses busy-waiting until all objects can be deleted.
+     * Since the reclaimer thread deletes the objects in the background, this is only necessary if
+     * you depend on the deletion.
      */
     static void gc(bool force) {
-        ScopedLock<UserSm> guard(&_sm);
-        if(!_objs)
-            return;
-
-        if(force) {
-            // wait until all objects are deletable
-            while(!deletable())
-                Util::pause();
-            _objs->_state = RCUObject::DELETABLE;
-        }
-        // check if the last invalidated object is deletable as well
-        else if(deletable())
-            _objs->_state = RCUObject::DELETABLE;
-
-        delete_objects();
+        while(collect() && force)
+            Util::pause();
     }
 
     /**
@@ -249,77 +301,114 @@ public:
     }
 
 private:
-    static void delete_objects() {
-        bool deletable = false;
+    /**
+     * Deletes all objects that are safe to delete.
+     *
+     * @return true if there are still objects left
+     */
+    static bool collect() {
+        RCUObject *dead;
+        bool pending;
+        {
+            ScopedLock<UserSm> guard(&_sm);
+            dead = advance();
+            pending = _objs != nullptr;
+        }
+        delete_objects(dead);
+        return pending;
+    }
+
+    static RCUObject *advance() {
+        // if all threads have passed a quiescent state since the last snapshot, the current grace
+        // period is over and we start the next one
+        // the pointers to the invalidated objects have been removed before. make sure that we
+        // load the counters afterwards (pairs with the fence in RCULock::enter()).
+        Sync::memory_fence();
+        if(_objs && deletable()) {
+            _epoch++;
+            store_versions();
+        }
+        return collect_objects();
+    }
+
+    static RCUObject *collect_objects() {
+        // an object that has been invalidated in grace period X is not covered by X, because the
+        // snapshot for X has been taken before the invalidation. a reader that entered its read
+        // section in between and still holds a pointer to the object would count as quiescent.
+        // the snapshot for X + 1 is taken after the invalidation and a fence. since readers
+        // fence between the counter update and their first load, every reader that could still
+        // load a pointer to the object has its counter visible by then and is thus recorded as
+        // active. so, when X + 1 is over, i.e. all of them have left or re-entered their section,
+        // it's safe to delete it. this holds no matter how quickly the grace periods follow each
+        // other.
+        // since the objects are sorted by epoch in descending order, all objects behind the first
+        // deletable one are deletable as well.
         RCUObject *p = nullptr, *o = _objs;
-        while(o != nullptr) {
-            // all objects behind the first deletable one are deletable
-            if(!deletable && o->_state != RCUObject::DELETABLE) {
-                p = o;
-                o = o->_next;
-                continue;
-            }
+        while(o != nullptr && o->_epoch + 2 > _epoch) {
+            p = o;
+            o = o->_next;
+        }
+        if(p)
+            p->_next = nullptr;
+        else
+            _objs = nullptr;
+        return o;
+    }
 
-            deletable = true;
+    static void delete_objects(RCUObject *o) {
+        while(o != nullptr) {
             RCUObject *n = o->_next;
             delete o;
-            if(p)
-                p->_next = n;
-            else
-                _objs = n;
             o = n;
         }
     }
 
     static bool deletable() {
-        // if new Ecs have been added since the last invalidation, we don't know whether this one
-        // is currently accessing an object. So, store all version-numbers again.
-        if(_versions_count != _ecs.length())
-            store_versions();
-
-        ScopedLock<UserSm> guard(&_ecsm);
-        size_t i = 0;
-        for(auto it = _ecs.begin(); it != _ecs.end(); ++it, ++i) {
-            // it's safe to delete it when either the Thread has re-entered the critical section
-            // or if it's out of its critical section. in both cases the Thread would re-read the
-            // pointer and thus, can't get the object again we're about to delete.
-            uint32_t counter = it->_rcu_counter;
-            if(!((counter >> 16) != (_versions[i] >> 16) || (counter & 0xFFFF) == 0))
-                return false;
+        for(size_t i = 0; i < Hip::MAX_CPUS; ++i) {
+            ThreadList &list = _threads[i];
+            ScopedLock<SpinLock> guard(&list.lock);
+            for(auto it = list.ecs.begin(); it != list.ecs.end(); ++it) {
+                // it's safe to delete it when either the Thread has re-entered the critical section
+                // or if it's out of its critical section. in both cases the Thread would re-read the
+                // pointer and thus, can't get the object again we're about to delete.
+                uint32_t counter = it->_rcu_counter;
+                if(!((counter >> 16) != (it->_rcu_snapshot >> 16) || (counter & 0xFFFF) == 0))
+                    return false;
+            }
         }
         return true;
     }
 
     static void store_versions() {
-        // new Ecs added?
-        if(_versions_count != _ecs.length()) {
-            delete[] _versions;
-            _versions_count = _ecs.length();
-            _versions = new uint32_t[_ecs.length()];
-        }
-
         // update the version-numbers for all Ecs
-        ScopedLock<UserSm> guard(&_ecsm);
-        size_t i = 0;
-        for(auto it = _ecs.begin(); it != _ecs.end(); ++it, ++i)
-            _versions[i] = it->_rcu_counter;
+        for(size_t i = 0; i < Hip::MAX_CPUS; ++i) {
+            ThreadList &list = _threads[i];
+            ScopedLock<SpinLock> guard(&list.lock);
+            for(auto it = list.ecs.begin(); it != list.ecs.end(); ++it)
+                it->_rcu_snapshot = it->_rcu_counter;
+        }
     }
 
+    // the reclaimer checks for finished grace periods every 1 / RECLAIM_FREQ seconds
+    static const timevalue_t RECLAIM_FREQ   = 1000;
+
+    static void notify_reclaimer();
+    static void reclaimer(void*);
+
     RCU();
     ~RCU();
     RCU(const RCU&);
     RCU& operator=(const RCU&);
 
-    static uint32_t *_versions;
-    static size_t _versions_count;
-    static SList<Thread> _ecs;
+    static size_t _epoch;
     static RCUObject *_objs;
     static UserSm _sm;
-    // note that we use a separate lock for the ec list, because it might happen that someone
-    // destroys a thread with the destructor of an RCUObject. so, when we used the same Sm,
-    // it would cause a deadlock.
-    static UserSm _ecsm;
+    // note that we use separate locks for the thread lists, because it might happen that someone
+    // destroys a thread with the destructor of an RCUObject.
+    static ThreadList _threads[Hip::MAX_CPUS];
     static RCULock _lock;
+    static UserSm _reclaimsm;
+    static bool _reclaimer_started;
 };
 
 }
@@ -179,6 +179,19 @@ public:
     static void sm_ctrl(capsel_t sm, SmOp op) {
         SyscallABI::syscall(sm << 8 | SM_CTRL | op);
     }
+    /**
+     * Performs a down or zero on the given Sm, but blocks at most until the TSC has reached
+     * <timeout>. The kernel uses the local APIC timer of the current CPU for that.
+     *
+     * @param sm the capability selector for the Sm
+     * @param op the operation (DOWN or ZERO)
+     * @param timeout the absolute TSC value (0 = no timeout)
+     * @throws SyscallException if the system-call failed (result != E_SUCCESS). If the timeout
+     *  has been reached, the error code is E_TIMEOUT.
+     */
+    static void sm_ctrl(capsel_t sm, SmOp op, timevalue_t timeout) {
+        SyscallABI::syscall(sm << 8 | SM_CTRL | op, timeout >> 32, timeout & 0xFFFFFFFF);
+    }
 
     /**
      * Get consumed CPU time of the given Sc
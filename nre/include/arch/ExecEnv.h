@@ -40,6 +40,7 @@ public:
     static const size_t STACK_SIZE          = ARCH_STACK_SIZE;
     static const size_t PT_ENTRY_COUNT      = PAGE_SIZE / sizeof(uint32_t);
     static const size_t BIG_PAGE_SIZE       = PAGE_SIZE * PT_ENTRY_COUNT;
+    static const size_t HUGE_PAGE_SIZE      = static_cast<size_t>(1) << ARCH_HUGE_PAGE_SHIFT;
     static const uintptr_t KERNEL_START     = ARCH_KERNEL_START;
     static const size_t PHYS_ADDR_SIZE      = 40;
     static const size_t EXIT_CODE_NUM       = 0x20;
@@ -22,6 +22,7 @@
 #define ARCH_PAGE_SHIFT     12
 #define ARCH_PAGE_SIZE      (1 << ARCH_PAGE_SHIFT)
 #define ARCH_STACK_SIZE     (ARCH_PAGE_SIZE * 2)        // has to be a power of 2
+#define ARCH_HUGE_PAGE_SHIFT 22                         // the biggest superpage (4M)
 #define FMT_WORD_HEXLEN     "8"
 #define FMT_WORD_BYTES      "4"
 #define ASM_WORD_TYPE       ".long"
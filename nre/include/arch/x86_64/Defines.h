@@ -22,6 +22,7 @@
 #define ARCH_PAGE_SHIFT     12
 #define ARCH_PAGE_SIZE      (1 << ARCH_PAGE_SHIFT)
 #define ARCH_STACK_SIZE     (ARCH_PAGE_SIZE * 2)        // has to be a power of 2
+#define ARCH_HUGE_PAGE_SHIFT 30                         // the biggest superpage (1G)
 #define FMT_WORD_HEXLEN     "16"
 #define FMT_WORD_BYTES      "8"
 #define ASM_WORD_TYPE       ".quad"
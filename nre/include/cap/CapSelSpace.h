@@ -84,32 +84,61 @@ public:
     }
 
     /**
-     * Allocates <count> selectors with alignment <align>.
+     * Allocates <count> selectors with alignment <align>. Note that the selectors are managed in
+     * blocks of a power of 2, i.e. <count> and <align> are rounded up accordingly.
      *
      * @param count the number of selectors to allocate (default = 1)
      * @param align the alignment of the selectors (default = 1). has to be a power of 2!
      */
-    capsel_t allocate(uint count = 1, uint align = 1) {
-        ScopedLock<SpinLock> lock(&_lck);
-        capsel_t res = (_off + align - 1) & ~(align - 1);
-        if(res + count < res || res + count > Hip::get().cfg_cap)
-            throw CapException(E_NO_CAP_SELS);
-        _off = res + count;
-        return res;
-    }
+    capsel_t allocate(uint count = 1, uint align = 1);
     /**
-     * Free's the selectors <base>...<base>+<count>-1
+     * Free's the selectors <base>...<base>+<count>-1. <count> and <align> have to be the same as
+     * used for allocate(). All capabilities that are still present at these selectors are revoked,
+     * including all capabilities that have been delegated from them to others. That is, you have
+     * to free the selectors only if nobody should have access to these objects anymore.
      *
      * @param base the base of the selectors
      * @param count the number (default = 1)
+     * @param align the alignment (default = 1)
      */
-    void free(UNUSED capsel_t base, UNUSED uint count = 1) {
-        // TODO implement me
-    }
+    void free(capsel_t base, uint count = 1, uint align = 1);
 
 private:
-    explicit CapSelSpace() : _lck(), _off(Hip::get().object_caps()) {
+    /**
+     * Small blocks are cached per CPU, so that the hot paths (delegation windows, single
+     * selectors for Sms, Pts, ...) don't need to take the global lock.
+     */
+    static const uint CACHE_ORDERS      = 4;
+    static const uint CACHE_SIZE        = 8;
+    /**
+     * The free blocks of all other sizes and the ones that don't fit into the per-CPU caches.
+     * If a list is full, the block is dropped.
+     */
+    static const uint FREE_ORDERS       = 24;
+    static const uint FREE_SIZE         = 32;
+
+    struct BlockList {
+        uint count;
+        capsel_t blocks[FREE_SIZE];
+    };
+    struct CPUCache {
+        SpinLock lck;
+        uint count[CACHE_ORDERS];
+        capsel_t blocks[CACHE_ORDERS][CACHE_SIZE];
+    };
+
+    explicit CapSelSpace() : _lck(), _off(Hip::get().object_caps()), _free(), _caches() {
+    }
+
+    static uint order_of(uint count) {
+        uint order = 0;
+        while((1U << order) < count)
+            order++;
+        return order;
     }
+    CPUCache *cache();
+    capsel_t allocate_block(uint order);
+    void free_block(capsel_t base, uint order);
 
     CapSelSpace(const CapSelSpace&);
     CapSelSpace& operator=(const CapSelSpace&);
@@ -117,6 +146,8 @@ private:
     static CapSelSpace _inst;
     SpinLock _lck;
     capsel_t _off;
+    BlockList _free[FREE_ORDERS];
+    CPUCache _caches[Hip::MAX_CPUS];
 };
 
 }
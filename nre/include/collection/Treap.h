@@ -103,6 +103,29 @@ public:
         return nullptr;
     }
 
+    /**
+     * Finds the node with the largest key that is less than or equal to the given one. This is
+     * useful if the keys are the beginnings of non-overlapping ranges and you want to find the
+     * range that contains <key>.
+     *
+     * @param key the key
+     * @return the node or nullptr if all nodes have a larger key
+     */
+    T *find_floor(typename T::key_t key) {
+        node_t *res = nullptr;
+        for(node_t *p = _root; p != nullptr; ) {
+            if(p->_key == key)
+                return static_cast<T*>(p);
+            if(key < p->_key)
+                p = p->_left;
+            else {
+                res = p;
+                p = p->_right;
+            }
+        }
+        return static_cast<T*>(res);
+    }
+
     /**
      * Inserts the given node in the tree. Note that it is expected, that the key of the node is
      * already set.
@@ -20,6 +20,7 @@
 #include <mem/DataSpace.h>
 #include <util/Sync.h>
 #include <util/Math.h>
+#include <util/Util.h>
 
 namespace nre {
 
@@ -42,6 +43,8 @@ class Consumer {
     struct Interface {
         volatile size_t rpos;
         volatile size_t wpos;
+        // whether the consumer is about to block, i.e. needs to be notified
+        volatile size_t sleeping;
         T buffer[];
     };
 
@@ -58,10 +61,11 @@ public:
     explicit Consumer(DataSpace &ds, Sm &sm, bool init = false)
         : _ds(ds), _if(reinterpret_cast<Interface*>(ds.virt())),
           _max(Math::prev_pow2((ds.size() - sizeof(Interface)) / sizeof(T))),
-          _sm(sm), _stop(false) {
+          _sm(sm), _stop(false), _spin(0) {
         if(init) {
             _if->rpos = 0;
             _if->wpos = 0;
+            _if->sleeping = 0;
         }
     }
 
@@ -72,6 +76,17 @@ public:
         return _max;
     }
 
+    /**
+     * Sets the time to poll for new data before blocking on the semaphore. This is useful if the
+     * producer will probably deliver the next item soon, because the producer only needs to do
+     * a syscall to notify the consumer if it is blocked.
+     *
+     * @param cycles the number of cycles to poll (0 = don't poll)
+     */
+    void set_spin(timevalue_t cycles) {
+        _spin = cycles;
+    }
+
     /**
      * Stops waiting for the producer. This way, if get() is blocked on the semaphore, it will
      * be unblocked.
@@ -107,15 +122,10 @@ public:
         while(EXPECT_FALSE(_if->rpos == _if->wpos)) {
             if(EXPECT_FALSE(_stop))
                 return nullptr;
-            // they might fail if someone revokes the Sm-caps
-            try {
-                _sm.zero();
-            }
-            catch(...) {
+            if(!wait())
                 return nullptr;
-            }
         }
-        return _if->buffer + _if->rpos;
+        return _if->buffer + pos();
     }
 
     /**
@@ -123,15 +133,68 @@ public:
      * never touch the item while you're working with it)
      */
     void next() {
-        _if->rpos = (_if->rpos + 1) & (_max - 1);
+        _if->rpos = (pos() + 1) & (_max - 1);
+    }
+
+    /**
+     * Copies up to <count> items into <values>. If there is no item, it blocks like get(). That
+     * is, it returns as soon as at least one item is available and takes all available items with
+     * a single semaphore operation.
+     *
+     * @param values the array to copy the items to
+     * @param count the number of items that fit into <values>
+     * @return the number of copied items (0 if it has been stopped and there is no data anymore)
+     */
+    size_t consume_n(T *values, size_t count) {
+        if(!get())
+            return 0;
+        size_t n = 0;
+        while(n < count && has_data()) {
+            values[n++] = _if->buffer[pos()];
+            next();
+        }
+        return n;
     }
 
 private:
+    size_t pos() const {
+        // the other side might have write access to the dataspace. so, never trust rpos
+        return _if->rpos & (_max - 1);
+    }
+
+    bool wait() {
+        if(_spin) {
+            timevalue_t end = Util::tsc() + _spin;
+            while(!has_data() && Util::tsc() < end)
+                Util::pause();
+            if(has_data())
+                return true;
+        }
+
+        // announce that we're going to block and check again afterwards. otherwise, we might miss
+        // the notification of a producer that didn't see the flag yet.
+        _if->sleeping = 1;
+        Sync::memory_fence();
+        bool res = true;
+        if(!has_data() && !_stop) {
+            // they might fail if someone revokes the Sm-caps
+            try {
+                _sm.zero();
+            }
+            catch(...) {
+                res = false;
+            }
+        }
+        _if->sleeping = 0;
+        return res;
+    }
+
     DataSpace &_ds;
     Interface *_if;
     size_t _max;
     Sm &_sm;
     bool _stop;
+    timevalue_t _spin;
 };
 
 }
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2012, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <kobj/Sm.h>
+#include <mem/DataSpace.h>
+#include <util/Sync.h>
+#include <util/Math.h>
+#include <util/Util.h>
+
+namespace nre {
+
+template<typename T>
+class MPSCProducer;
+
+/**
+ * Consumer-part for the producer-consumer-communication over a dataspace with multiple producers.
+ * In contrast to Consumer, the producers don't need to synchronize with each other. They reserve
+ * slots atomically and publish each slot by setting its sequence number, which the consumer
+ * checks before reading it.
+ *
+ * Usage-example:
+ * MPSCConsumer<char> cons(ds, sm);
+ * for(char *c; (c = cons.get()) != nullptr; cons.next()) {
+ *   // do something with *c
+ * }
+ */
+template<typename T>
+class MPSCConsumer {
+    friend class MPSCProducer<T>;
+
+    struct Slot {
+        // is position + 1 as soon as the slot has been written for the position
+        volatile size_t seq;
+        T value;
+    };
+
+    struct Interface {
+        // the positions are not wrapped, i.e. the index is pos & (max - 1)
+        volatile size_t rpos;
+        volatile size_t wpos;
+        // whether the consumer is about to block, i.e. needs to be notified
+        volatile size_t sleeping;
+        Slot buffer[];
+    };
+
+public:
+    /**
+     * Creates a consumer that uses the given dataspace for communication
+     *
+     * @param ds the dataspace
+     * @param sm the semaphore to use for signaling (has to be shared with the producers of course)
+     * @param init whether the consumer should init the state. this should only be done by one
+     *  party and preferably by the first one. That is, if the client is the consumer it should
+     *  init it (because it will create the dataspace and share it to the service).
+     */
+    explicit MPSCConsumer(DataSpace &ds, Sm &sm, bool init = false)
+        : _ds(ds), _if(reinterpret_cast<Interface*>(ds.virt())),
+          _max(Math::prev_pow2((ds.size() - sizeof(Interface)) / sizeof(Slot))),
+          _sm(sm), _stop(false), _spin(0) {
+        if(init)
+            reset(_if, _max);
+    }
+
+    /**
+     * @return the length of the ring-buffer
+     */
+    size_t rblength() const {
+        return _max;
+    }
+
+    /**
+     * Sets the time to poll for new data before blocking on the semaphore. This is useful if the
+     * producers will probably deliver the next item soon, because a producer only needs to do
+     * a syscall to notify the consumer if it is blocked.
+     *
+     * @param cycles the number of cycles to poll (0 = don't poll)
+     */
+    void set_spin(timevalue_t cycles) {
+        _spin = cycles;
+    }
+
+    /**
+     * Announces whether the consumer is blocked (or about to block) on the semaphore, i.e. whether
+     * the producers have to notify it. get() and consume_n() do that automatically. So, this is only
+     * required if you wait for multiple rings with one semaphore.
+     *
+     * @param sleeping whether the consumer is sleeping
+     */
+    void sleeping(bool sleeping) {
+        _if->sleeping = sleeping;
+    }
+
+    /**
+     * Stops waiting for the producers. This way, if get() is blocked on the semaphore, it will
+     * be unblocked.
+     */
+    void stop() {
+        _stop = true;
+        Sync::memory_barrier();
+        try {
+            _sm.up();
+        }
+        catch(...) {
+            // ignore it
+        }
+    }
+
+    /**
+     * @return whether there is more data to read
+     */
+    bool has_data() const {
+        return ready(_if->rpos);
+    }
+
+    /**
+     * Retrieves the item at current position. If there is no item anymore, it blocks until a
+     * producer notifies it, that there is data available. You might interrupt that by using stop().
+     * Note that the method will only return 0 if it has been stopped *and* there is no data anymore.
+     *
+     * Important: You have to call next() to move to the next item.
+     *
+     * @return pointer to the data
+     */
+    T *get() {
+        if(!wait())
+            return nullptr;
+        return &_if->buffer[_if->rpos & (_max - 1)].value;
+    }
+
+    /**
+     * Tells the producers that you're done working with the current item (i.e. the producers will
+     * never touch the item while you're working with it)
+     */
+    void next() {
+        Sync::memory_barrier();
+        _if->rpos = _if->rpos + 1;
+    }
+
+    /**
+     * Copies up to <count> items into <values>. If there is no item, it blocks like get(). That
+     * is, it returns as soon as at least one item is available and takes all available items with
+     * a single semaphore operation.
+     *
+     * @param values the array to copy the items to
+     * @param count the number of items that fit into <values>
+     * @return the number of copied items (0 if it has been stopped and there is no data anymore)
+     */
+    size_t consume_n(T *values, size_t count) {
+        if(!wait())
+            return 0;
+        size_t pos = _if->rpos;
+        size_t n;
+        for(n = 0; n < count && ready(pos + n); ++n)
+            values[n] = _if->buffer[(pos + n) & (_max - 1)].value;
+        Sync::memory_barrier();
+        _if->rpos = pos + n;
+        return n;
+    }
+
+private:
+    static void reset(Interface *iface, size_t max) {
+        iface->rpos = 0;
+        iface->wpos = 0;
+        iface->sleeping = 0;
+        for(size_t i = 0; i < max; ++i)
+            iface->buffer[i].seq = 0;
+    }
+
+    bool ready(size_t pos) const {
+        bool res = _if->buffer[pos & (_max - 1)].seq == pos + 1;
+        // don't read the value before the sequence number
+        Sync::memory_barrier();
+        return res;
+    }
+
+    bool wait() {
+        while(EXPECT_FALSE(!has_data())) {
+            if(EXPECT_FALSE(_stop))
+                return false;
+            if(!block())
+                return false;
+        }
+        return true;
+    }
+
+    bool block() {
+        if(_spin) {
+            timevalue_t end = Util::tsc() + _spin;
+            while(!has_data() && Util::tsc() < end)
+                Util::pause();
+            if(has_data())
+                return true;
+        }
+
+        // announce that we're going to block and check again afterwards. otherwise, we might miss
+        // the notification of a producer that didn't see the flag yet.
+        _if->sleeping = 1;
+        Sync::memory_fence();
+        bool res = true;
+        if(!has_data() && !_stop) {
+            // they might fail if someone revokes the Sm-caps
+            try {
+                _sm.zero();
+            }
+            catch(...) {
+                res = false;
+            }
+        }
+        _if->sleeping = 0;
+        return res;
+    }
+
+    DataSpace &_ds;
+    Interface *_if;
+    size_t _max;
+    Sm &_sm;
+    bool _stop;
+    timevalue_t _spin;
+};
+
+}
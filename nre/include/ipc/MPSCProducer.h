@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2012, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <mem/DataSpace.h>
+#include <ipc/MPSCConsumer.h>
+#include <util/Atomic.h>
+#include <util/Sync.h>
+#include <util/Math.h>
+
+namespace nre {
+
+/**
+ * Producer-part for the producer-consumer-communication over a dataspace with multiple producers.
+ * That is, in contrast to Producer, you can use the same object from multiple threads (on
+ * multiple CPUs) without a lock.
+ */
+template<typename T>
+class MPSCProducer {
+    typedef typename MPSCConsumer<T>::Interface Interface;
+
+public:
+    /**
+     * Creates a producer that uses the given dataspace for communication
+     *
+     * @param ds the dataspace
+     * @param sm the semaphore to use for signaling (has to be shared with the consumer of course)
+     * @param init whether the producer should init the state. this should only be done by one
+     *  party and preferably by the first one. That is, if the client is the producer it should
+     *  init it (because it will create the dataspace and share it to the service).
+     */
+    explicit MPSCProducer(DataSpace &ds, Sm &sm, bool init = true)
+        : _ds(ds), _if(reinterpret_cast<Interface*>(ds.virt())),
+          _max(Math::prev_pow2((ds.size() - sizeof(Interface)) /
+                               sizeof(typename MPSCConsumer<T>::Slot))),
+          _sm(sm) {
+        if(init)
+            MPSCConsumer<T>::reset(_if, _max);
+    }
+
+    /**
+     * @return the length of the ring-buffer
+     */
+    size_t rblength() const {
+        return _max;
+    }
+
+    /**
+     * Produces the given item, if there is a free slot, and notifies the consumer.
+     *
+     * @param value the value to produce
+     * @return true if the item has been written successfully
+     */
+    bool produce(const T &value) {
+        return produce_n(&value, 1) == 1;
+    }
+
+    /**
+     * Produces as many of the given items as there are free slots and notifies the consumer once.
+     *
+     * @param values the items
+     * @param count the number of items
+     * @return the number of items that have been written
+     */
+    size_t produce_n(const T *values, size_t count) {
+        size_t pos;
+        size_t n = reserve(count, &pos);
+        for(size_t i = 0; i < n; ++i) {
+            typename MPSCConsumer<T>::Slot *slot = _if->buffer + ((pos + i) & (_max - 1));
+            slot->value = values[i];
+            // publish the value
+            Sync::memory_barrier();
+            slot->seq = pos + i + 1;
+        }
+        if(n > 0)
+            notify();
+        return n;
+    }
+
+private:
+    /**
+     * Reserves up to <count> consecutive slots.
+     */
+    size_t reserve(size_t count, size_t *pos) {
+        while(true) {
+            size_t wpos = _if->wpos;
+            // the consumer increases rpos after it is done with a slot. so, all slots before
+            // rpos + max are free.
+            size_t used = wpos - _if->rpos;
+            if(EXPECT_FALSE(used >= _max)) {
+                // if wpos is outdated, try again
+                if(wpos != _if->wpos)
+                    continue;
+                return 0;
+            }
+            size_t n = Math::min(count, _max - used);
+            if(Atomic::cmpnswap(&_if->wpos, wpos, wpos + n)) {
+                *pos = wpos;
+                return n;
+            }
+        }
+    }
+
+    void notify() {
+        // the consumer sets the flag before it checks for new data the last time. so, either it
+        // sees the published slot or we see the flag.
+        Sync::memory_fence();
+        if(!_if->sleeping)
+            return;
+        try {
+            _sm.up();
+        }
+        catch(...) {
+            // if the client closed the session, we might get here. so, just ignore it.
+        }
+    }
+
+    DataSpace &_ds;
+    Interface *_if;
+    size_t _max;
+    Sm &_sm;
+};
+
+}
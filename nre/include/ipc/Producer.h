@@ -46,6 +46,7 @@ public:
         if(init) {
             _if->rpos = 0;
             _if->wpos = 0;
+            _if->sleeping = 0;
         }
     }
 
@@ -71,10 +72,28 @@ public:
     /**
      * Moves to the next slot. That is, the position is moved forward and the consumer is notified,
      * that new data is available
+     *
+     * @param notify whether to notify the consumer. If you pass false, you can put multiple items
+     *  into the ring and notify the consumer only once afterwards via notify().
      */
-    void next() {
+    void next(bool notify = true) {
         _if->wpos = (_if->wpos + 1) & (_max - 1);
         Sync::memory_barrier();
+        if(notify)
+            this->notify();
+    }
+
+    /**
+     * Notifies the consumer that new data is available. This is only required if you've used
+     * next(false) before. Note that this does only cost a syscall if the consumer is blocked or
+     * about to block.
+     */
+    void notify() {
+        // the consumer sets the flag before it checks for new data the last time. so, either it
+        // sees the new wpos or we see the flag.
+        Sync::memory_fence();
+        if(!_if->sleeping)
+            return;
         try {
             _sm.up();
         }
@@ -99,6 +118,27 @@ public:
         return slot != 0;
     }
 
+    /**
+     * Produces as many of the given items as there are free slots and notifies the consumer once.
+     *
+     * @param values the items
+     * @param count the number of items
+     * @return the number of items that have been written
+     */
+    size_t produce_n(const T *values, size_t count) {
+        size_t n;
+        for(n = 0; n < count; ++n) {
+            T *slot = current();
+            if(!slot)
+                break;
+            *slot = values[n];
+            next(false);
+        }
+        if(n > 0)
+            notify();
+        return n;
+    }
+
 private:
     DataSpace &_ds;
     typename Consumer<T>::Interface * _if;
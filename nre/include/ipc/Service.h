@@ -61,9 +61,29 @@ class Service {
     friend class SessionIterator;
 
 public:
-    static const uint MAX_SESSIONS_ORDER        =   6;
+    static const uint SESSION_CHUNK_ORDER       =   5;
+    static const size_t SESSION_CHUNK_SIZE      =   1 << SESSION_CHUNK_ORDER;
+    static const uint MAX_SESSIONS_ORDER        =   11;
     static const size_t MAX_SESSIONS            =   1 << MAX_SESSIONS_ORDER;
+    static const size_t MAX_SESSION_CHUNKS      =   MAX_SESSIONS / SESSION_CHUNK_SIZE;
 
+private:
+    /**
+     * The sessions are managed in chunks, which are allocated on demand. The capability selectors
+     * for the session portals are reserved upfront for all chunks, so that the session-id can be
+     * calculated from the portal selector.
+     */
+    struct SessionChunk {
+        explicit SessionChunk(capsel_t _caps) : caps(_caps), used(), sessions() {
+        }
+
+        capsel_t caps;
+        // a bitmap of the used slots
+        word_t used;
+        ServiceSession *sessions[SESSION_CHUNK_SIZE];
+    };
+
+public:
     /**
      * The commands the parent provides for working with services
      */
@@ -87,7 +107,8 @@ public:
         : _regcaps(CapSelSpace::get().allocate(1 << CPU::order(), 1 << CPU::order())),
           _caps(CapSelSpace::get().allocate(MAX_SESSIONS << CPU::order(), MAX_SESSIONS << CPU::order())),
           _sm(), _kill_sm(), _stop(false), _name(name), _func(portal),
-          _insts(new ServiceCPUHandler *[CPU::count()]), _reg_cpus(cpus.get()), _sessions() {
+          _insts(new ServiceCPUHandler *[CPU::count()]), _reg_cpus(cpus.get()), _chunk_count(),
+          _chunks() {
         for(size_t i = 0; i < CPU::count(); ++i) {
             if(_reg_cpus.is_set(i))
                 _insts[i] = new ServiceCPUHandler(this, _regcaps + i, i);
@@ -99,14 +120,20 @@ public:
      * Destroys this service, i.e. destroys all sessions. You should have called unreg() before.
      */
     virtual ~Service() {
-        for(size_t i = 0; i < MAX_SESSIONS; ++i) {
-            ServiceSession *sess = rcu_dereference(_sessions[i]);
-            if(sess)
-                remove_session(sess);
+        for(size_t c = 0; c < _chunk_count; ++c) {
+            for(size_t i = 0; i < SESSION_CHUNK_SIZE; ++i) {
+                ServiceSession *sess = rcu_dereference(_chunks[c]->sessions[i]);
+                if(sess)
+                    remove_session(sess);
+            }
         }
+        // the sessions might refer to us. so, wait until they are deleted
+        RCU::gc(true);
         for(size_t i = 0; i < CPU::count(); ++i)
             delete _insts[i];
         delete[] _insts;
+        for(size_t c = 0; c < _chunk_count; ++c)
+            delete _chunks[c];
         CapSelSpace::get().free(_caps, MAX_SESSIONS << CPU::order());
         CapSelSpace::get().free(_regcaps, 1 << CPU::order());
     }
@@ -145,12 +172,6 @@ public:
     Pt::portal_func portal() const {
         return _func;
     }
-    /**
-     * @return the capabilities used for all session-portals
-     */
-    capsel_t caps() const {
-        return _caps;
-    }
     /**
      * @return the bitmask that specified on which CPUs it is available
      */
@@ -158,6 +179,13 @@ public:
         return _reg_cpus;
     }
 
+    /**
+     * @return the capabilities used for all session-portals
+     */
+    capsel_t caps() const {
+        return _caps;
+    }
+
     /**
      * @return the iterator-beginning to walk over all sessions (note that you need to use an
      *  RCULock to prevent that sessions are destroyed while iterating over them)
@@ -177,7 +205,7 @@ public:
      */
     template<class T>
     T *get_session(capsel_t pid) {
-        return get_session_by_id<T>((pid - _caps) >> CPU::order());
+        return get_session_by_id<T>(session_id(pid));
     }
     /**
      * @param id the session-id
@@ -186,7 +214,11 @@ public:
      */
     template<class T>
     T *get_session_by_id(size_t id) {
-        T *sess = static_cast<T*>(rcu_dereference(_sessions[id]));
+        T *sess = nullptr;
+        if((id >> SESSION_CHUNK_ORDER) < rcu_dereference(_chunk_count)) {
+            SessionChunk *chunk = rcu_dereference(_chunks[id >> SESSION_CHUNK_ORDER]);
+            sess = static_cast<T*>(rcu_dereference(chunk->sessions[id & (SESSION_CHUNK_SIZE - 1)]));
+        }
         if(!sess)
             VTHROW(ServiceException, E_ARGS_INVALID, "Session " << id << " does not exist");
         return sess;
@@ -249,15 +281,27 @@ private:
         uf.check_reply();
     }
 
-    void add_session(ServiceSession *sess) {
-        rcu_assign_pointer(_sessions[sess->id()], sess);
+    size_t session_id(capsel_t pid) const {
+        return (pid - _caps) >> CPU::order();
+    }
+    SessionChunk *add_chunk();
+
+    void add_session(SessionChunk *chunk, ServiceSession *sess) {
+        size_t idx = sess->id() & (SESSION_CHUNK_SIZE - 1);
+        chunk->used |= static_cast<word_t>(1) << idx;
+        rcu_assign_pointer(chunk->sessions[idx], sess);
         created_session(sess->id());
     }
     void remove_session(ServiceSession *sess) {
-        rcu_assign_pointer(_sessions[sess->id()], nullptr);
+        SessionChunk *chunk = _chunks[sess->id() >> SESSION_CHUNK_ORDER];
+        size_t idx = sess->id() & (SESSION_CHUNK_SIZE - 1);
+        rcu_assign_pointer(chunk->sessions[idx], nullptr);
+        chunk->used &= ~(static_cast<word_t>(1) << idx);
         sess->invalidate();
+        // destroy the portals now to be able to reuse the session-id immediately. the object
+        // itself is deleted in the background as soon as nobody uses it anymore.
+        sess->destroy_portals();
         RCU::invalidate(sess);
-        RCU::gc(true);
     }
     void check_sessions();
     void destroy_session(capsel_t pid);
@@ -274,13 +318,17 @@ private:
     Pt::portal_func _func;
     ServiceCPUHandler **_insts;
     BitField<Hip::MAX_CPUS> _reg_cpus;
-    ServiceSession *_sessions[MAX_SESSIONS];
+    // the chunks are never removed while the service exists. so, readers only need to make sure
+    // that they see the chunk before the increased count.
+    size_t _chunk_count;
+    SessionChunk *_chunks[MAX_SESSION_CHUNKS];
 };
 
 /**
  * The iterator to walk forwards or backwards over all sessions. We need that, because we have to
- * skip unused slots. Note that the iterator assumes that no sessions are destroyed while being
- * used. Sessions may be added or removed in the meanwhile.
+ * skip unused slots. Chunks without sessions are skipped as a whole. Note that the iterator
+ * assumes that no sessions are destroyed while being used. Sessions may be added or removed in
+ * the meanwhile.
  */
 template<class T>
 class SessionIterator {
@@ -291,7 +339,7 @@ public:
      * Creates an iterator that starts at given position
      *
      * @param s the service
-     * @param pos the start-position (index into session-array)
+     * @param pos the start-position (session-id)
      */
     explicit SessionIterator(Service *s, ssize_t pos = 0) : _s(s), _pos(pos), _last(next()) {
     }
@@ -303,7 +351,7 @@ public:
         return &operator*();
     }
     SessionIterator & operator++() {
-        if(_pos < static_cast<ssize_t>(Service::MAX_SESSIONS) - 1) {
+        if(_pos < limit()) {
             _pos++;
             _last = next();
         }
@@ -334,18 +382,38 @@ public:
     }
 
 private:
+    ssize_t limit() const {
+        return rcu_dereference(_s->_chunk_count) << Service::SESSION_CHUNK_ORDER;
+    }
+    Service::SessionChunk *chunk() const {
+        return rcu_dereference(_s->_chunks[_pos >> Service::SESSION_CHUNK_ORDER]);
+    }
     T *next() {
-        while(_pos < static_cast<ssize_t>(Service::MAX_SESSIONS)) {
-            T *t = static_cast<T*>(rcu_dereference(_s->_sessions[_pos]));
+        ssize_t end = limit();
+        while(_pos < end) {
+            Service::SessionChunk *c = chunk();
+            if(c->used == 0) {
+                // continue with the first slot of the next chunk
+                _pos = (_pos | (Service::SESSION_CHUNK_SIZE - 1)) + 1;
+                continue;
+            }
+            T *t = static_cast<T*>(rcu_dereference(c->sessions[_pos & (Service::SESSION_CHUNK_SIZE - 1)]));
             if(t)
                 return t;
             _pos++;
         }
+        _pos = end;
         return nullptr;
     }
     T *prev() {
         while(_pos >= 0) {
-            T *t = static_cast<T*>(rcu_dereference(_s->_sessions[_pos]));
+            Service::SessionChunk *c = chunk();
+            if(c->used == 0) {
+                // continue with the last slot of the previous chunk
+                _pos = (_pos & ~static_cast<ssize_t>(Service::SESSION_CHUNK_SIZE - 1)) - 1;
+                continue;
+            }
+            T *t = static_cast<T*>(rcu_dereference(c->sessions[_pos & (Service::SESSION_CHUNK_SIZE - 1)]));
             if(t)
                 return t;
             _pos--;
@@ -365,7 +433,7 @@ SessionIterator<T> Service::sessions_begin() {
 
 template<class T>
 SessionIterator<T> Service::sessions_end() {
-    return SessionIterator<T>(this, MAX_SESSIONS);
+    return SessionIterator<T>(this, rcu_dereference(_chunk_count) << SESSION_CHUNK_ORDER);
 }
 
 }
@@ -49,8 +49,7 @@ public:
      * Destroyes this session
      */
     virtual ~ServiceSession() {
-        for(uint i = 0; i < CPU::count(); ++i)
-            delete _pts[i];
+        destroy_portals();
         delete[] _pts;
     }
 
@@ -82,6 +81,13 @@ protected:
     }
 
 private:
+    void destroy_portals() {
+        for(uint i = 0; i < CPU::count(); ++i) {
+            delete _pts[i];
+            _pts[i] = nullptr;
+        }
+    }
+
     size_t _id;
     capsel_t _cap;
     capsel_t _caps;
@@ -78,6 +78,24 @@ public:
         Syscalls::sm_ctrl(sel(), Syscalls::SM_ZERO);
     }
 
+    /**
+     * Performs a zero on this semaphore, but blocks at most until the TSC has reached <timeout>.
+     *
+     * @param timeout the absolute TSC value
+     * @return true if someone did an up(), false if the timeout has been reached
+     */
+    bool zero_until(timevalue_t timeout) {
+        try {
+            Syscalls::sm_ctrl(sel(), Syscalls::SM_ZERO, timeout);
+            return true;
+        }
+        catch(const SyscallException &e) {
+            if(e.code() != E_TIMEOUT)
+                throw;
+            return false;
+        }
+    }
+
     /**
      * Performs an up on this semaphore. That is, if there is somebody blocking on it, it unblocks
      * it. Otherwise it increases the value of the semaphore.
@@ -148,6 +148,7 @@ private:
                            uintptr_t &stack, uint &flags);
 
     uint32_t _rcu_counter;
+    uint32_t _rcu_snapshot;
     uintptr_t _utcb_addr;
     uintptr_t _stack_addr;
     uint _flags;
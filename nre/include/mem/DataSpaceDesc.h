@@ -45,6 +45,12 @@ public:
         RX          = R | X,
         RWX         = R | W | X,
         BIGPAGES    = 1 << 3,   // use 4M pages; requires an align to 4M
+        // 1 << 4 is used by ChildMemory
+        SEQUENTIAL  = 1 << 5,   // hint: will be accessed sequentially; map as much as possible on faults
+        RANDOM      = 1 << 6,   // hint: will be accessed randomly; map only the faulting page
+        COW         = 1 << 7,   // shared ELF segments; copied on write (only set by the ChildManager)
+        ZEROED      = 1 << 8,   // the memory is zero'd (root hands out pre-zero'd memory, if available)
+        HUGE        = 1 << 9,   // use the biggest possible pages; root aligns it physically, if possible
     };
 
     /**
@@ -20,6 +20,7 @@
 #include <stream/OStream.h>
 #include <stream/OStringStream.h>
 #include <collection/DList.h>
+#include <collection/Treap.h>
 #include <util/Math.h>
 #include <util/Bytes.h>
 #include <Exception.h>
@@ -33,9 +34,26 @@ public:
     }
 };
 
-struct Region : public DListItem {
+template<class Reg>
+class RegionManager;
+
+/**
+ * A region is a list item (sorted by address), a node in the tree (with the address as key) and
+ * an item in the bin for its size class.
+ */
+struct Region : public DListItem, public TreapNode<uintptr_t> {
+    template<class Reg>
+    friend class RegionManager;
+
+    explicit Region() : DListItem(), TreapNode<uintptr_t>(0), addr(), size(), _bprev(), _bnext() {
+    }
+
     uintptr_t addr;
     size_t size;
+
+private:
+    Region *_bprev;
+    Region *_bnext;
 };
 
 class PortManager;
@@ -45,10 +63,18 @@ class PortManager;
  * can manage memory with it by adding some available memory to it (by using free()) and allocating
  * it chunk by chunk via alloc() later. The class will keep track of what parts are allocated and
  * what not.
+ *
+ * The free regions are kept in a list sorted by address, which is used for iteration, in a treap
+ * with the address as key, which is used to find the neighbours of a region, and in bins by size
+ * class (a power of two), which are used to find a region for an allocation. Thus, free() and
+ * alloc() don't have to walk through all regions.
  */
 template<class Reg = Region>
 class RegionManager {
     friend class PortManager;
+
+    static const size_t BINS    = sizeof(size_t) * 8;
+
 public:
     typedef typename DList<Reg>::iterator iterator;
     typedef typename DList<Reg>::const_iterator const_iterator;
@@ -56,7 +82,7 @@ public:
     /**
      * Creates an empty region list
      */
-    explicit RegionManager() : _regs() {
+    explicit RegionManager() : _regs(), _tree(), _bins() {
     }
     /**
      * Destroys all region-objects
@@ -69,7 +95,7 @@ public:
     }
 
     /**
-     * @return the beginning of all regions
+     * @return the beginning of all regions (sorted by address)
      */
     const_iterator begin() const {
         return _regs.cbegin();
@@ -102,21 +128,20 @@ public:
      */
     size_t alloc_at(uintptr_t start, size_t count, bool free_required = false) {
         size_t total = 0;
-        for(auto it = _regs.begin(); it != _regs.end(); ++it) {
-            if(nre::Math::overlapped(start, count, it->addr, it->size)) {
-                // since adjacent regions are merged, it is sufficient to check whether the
-                // desired range is inside this region. if not, there is something missing, which
-                // means that it is already allocated.
-                if(free_required && !(start >= it->addr && start + count <= it->addr + it->size)) {
-                    VTHROW(RegionManagerException, E_EXISTS,
-                           fmt(start, "p") << " .. " << fmt(start + count, "p") << " not free");
-                }
-                total += remove_from(&*it, start, count);
-                // we assume that there are no duplicates, thus we can stop here
-                if(free_required)
-                    break;
-                it = _regs.begin();
+        if(count == 0)
+            return 0;
+        // walk backwards from the last region that starts in the range. since the regions don't
+        // overlap, we are done as soon as we find one that ends before <start>.
+        Reg *r;
+        while((r = _tree.find_floor(start + count - 1)) && r->addr + r->size > start) {
+            // since adjacent regions are merged, it is sufficient to check whether the
+            // desired range is inside this region. if not, there is something missing, which
+            // means that it is already allocated.
+            if(free_required && !(start >= r->addr && start + count <= r->addr + r->size)) {
+                VTHROW(RegionManagerException, E_EXISTS,
+                       fmt(start, "p") << " .. " << fmt(start + count, "p") << " not free");
             }
+            total += remove_from(r, start, count);
         }
         return total;
     }
@@ -124,6 +149,8 @@ public:
     /**
      * Allocates <count> units from the region list, aligned to <align>. That is, it searches for
      * a region that contains at least <count> units (aligned to <align>) and takes them from it.
+     * The search starts at the size class of <count>, so that small allocations don't split big
+     * regions.
      *
      * @param count the number of units to allocate
      * @param align the alignment (in units)
@@ -137,22 +164,17 @@ public:
                    "Unable to allocate " << count << " units aligned to " << align);
         }
         uintptr_t org = r->addr;
+        uintptr_t end = r->addr + r->size;
         uintptr_t start = (r->addr + align - 1) & ~(align - 1);
-        count += start - r->addr;
-        r->addr += count;
-        r->size -= count;
-        // if there is space left before the start due to aligning, free it
+        // if there is space left before the start due to aligning, keep it in r
         if(start > org) {
-            Reg *nr = r;
-            // do we need a new region?
-            if(nr->size > 0) {
-                nr = new Reg;
-                _regs.append(nr);
-            }
-            nr->addr = org;
-            nr->size = start - org;
+            set(r, org, start - org);
+            if(end > start + count)
+                insert_reg(r, start + count, end - (start + count));
         }
-        if(r->size == 0)
+        else if(end > start + count)
+            set(r, start + count, end - (start + count));
+        else
             remove_reg(r);
         return start;
     }
@@ -165,82 +187,114 @@ public:
      * @param count the number of units
      */
     void free(uintptr_t start, size_t count) {
-        Reg *p = nullptr, *n = nullptr;
-        for(iterator it = _regs.begin(); it != _regs.end(); ++it) {
-            if(it->addr + it->size == start)
-                p = &*it;
-            else if(it->addr == start + count)
-                n = &*it;
-            if(n && p)
-                break;
-        }
+        Reg *p = _tree.find_floor(start);
+        Reg *n = _tree.find(start + count);
+        bool pmerge = p && p->addr + p->size == start;
 
-        if(n && p) {
-            p->size += count + n->size;
+        if(pmerge && n) {
+            set(p, p->addr, p->size + count + n->size);
             remove_reg(n);
         }
-        else if(n) {
-            n->addr -= count;
-            n->size += count;
-        }
-        else if(p)
-            p->size += count;
-        else {
-            Reg *f = new Reg;
-            f->addr = start;
-            f->size = count;
-            _regs.append(f);
-        }
+        else if(n)
+            set(n, start, count + n->size);
+        else if(pmerge)
+            set(p, p->addr, p->size + count);
+        else
+            insert_reg(p, start, count);
     }
 
 private:
     RegionManager(const RegionManager&);
     RegionManager& operator=(const RegionManager&);
 
+    static size_t bin_of(size_t size) {
+        return (sizeof(long) * 8 - 1) - __builtin_clzl(size | 1);
+    }
+
+    void bin_add(Reg *r) {
+        Region **bin = _bins + bin_of(r->size);
+        r->_bprev = nullptr;
+        r->_bnext = *bin;
+        if(*bin)
+            (*bin)->_bprev = r;
+        *bin = r;
+    }
+    void bin_remove(Reg *r) {
+        if(r->_bprev)
+            r->_bprev->_bnext = r->_bnext;
+        else
+            _bins[bin_of(r->size)] = r->_bnext;
+        if(r->_bnext)
+            r->_bnext->_bprev = r->_bprev;
+    }
+
+    void insert_reg(Reg *p, uintptr_t addr, size_t size) {
+        Reg *r = new Reg;
+        r->addr = addr;
+        r->size = size;
+        r->key(addr);
+        _regs.insert(p, r);
+        _tree.insert(r);
+        bin_add(r);
+    }
+
 protected:
     Reg *get(size_t count, size_t align) {
-        for(auto it = _regs.begin(); it != _regs.end(); ++it) {
-            if(it->size >= count) {
-                uintptr_t start = (it->addr + align - 1) & ~(align - 1);
-                if(it->size - (start - it->addr) >= count)
-                    return &*it;
+        for(size_t i = bin_of(count); i < BINS; ++i) {
+            for(Region *it = _bins[i]; it != nullptr; it = it->_bnext) {
+                if(it->size >= count) {
+                    uintptr_t start = (it->addr + align - 1) & ~(align - 1);
+                    if(start - it->addr <= it->size - count)
+                        return static_cast<Reg*>(it);
+                }
             }
         }
         return nullptr;
     }
 
+    /**
+     * Changes the range of region <r> to <addr> .. <addr>+<size>-1. The new range has to be in
+     * the same position relative to the other regions, i.e. it may not overlap another region or
+     * skip one. This never allocates or frees region objects.
+     */
+    void set(Reg *r, uintptr_t addr, size_t size) {
+        bin_remove(r);
+        r->addr = addr;
+        r->size = size;
+        // the order is not changed, so that we can change the key in place
+        r->key(addr);
+        bin_add(r);
+    }
     void remove_reg(Reg *r) {
+        bin_remove(r);
+        _tree.remove(r);
         _regs.remove(r);
         delete r;
     }
     size_t remove_from(Reg *r, uintptr_t start, size_t count) {
-        size_t res = count;
+        uintptr_t rend = r->addr + r->size;
+        uintptr_t end = start + count;
+        size_t res = Math::min(end, rend) - Math::max(start, r->addr);
         // complete region should be removed?
-        if(start <= r->addr && start + count >= r->addr + r->size) {
-            res = r->size;
+        if(start <= r->addr && end >= rend)
             remove_reg(r);
-        }
         // at the beginning?
-        else if(start <= r->addr) {
-            r->size -= (start + count) - r->addr;
-            r->addr = start + count;
-        }
+        else if(start <= r->addr)
+            set(r, end, rend - end);
         // at the end?
-        else if(start + count >= r->addr + r->size)
-            r->size = start - r->addr;
+        else if(end >= rend)
+            set(r, r->addr, start - r->addr);
         // in the middle
         else {
-            size_t oldsize = r->size;
-            r->size = start - r->addr;
-            Reg *nr = new Reg;
-            nr->addr = start + count;
-            nr->size = (r->addr + oldsize) - nr->addr;
-            _regs.append(nr);
+            set(r, r->addr, start - r->addr);
+            insert_reg(r, end, rend - end);
         }
         return res;
     }
 
     DList<Reg> _regs;
+    Treap<Reg> _tree;
+    Region *_bins[BINS];
 };
 
 template<class Reg>
@@ -18,35 +18,107 @@
 
 #include <ipc/PtClientSession.h>
 #include <ipc/Connection.h>
+#include <ipc/MPSCProducer.h>
 #include <utcb/UtcbFrame.h>
+#include <util/ScopedCapSels.h>
+#include <mem/DataSpace.h>
 #include <kobj/Pt.h>
+#include <kobj/Sm.h>
+#include <cstring>
 
 namespace nre {
 
 /**
- * Represents a session at the log-service
+ * Represents a session at the log-service. If possible, the lines are transferred via a ring in
+ * shared memory that is provided by the service. Otherwise, each line is sent via a portal call.
  */
 class LogSession : public PtClientSession {
 public:
+    /**
+     * The available commands
+     */
+    enum Command {
+        WRITE,
+        SHARE
+    };
+
+    /**
+     * A line in the shared ring
+     */
+    struct Line {
+        size_t len;
+        char text[128];
+    };
+
     /**
      * Creates a new session with given connection
      *
      * @param con the connection
      */
-    explicit LogSession(Connection &con) : PtClientSession(con) {
+    explicit LogSession(Connection &con) : PtClientSession(con), _ds(), _sm(), _prod() {
+        try {
+            share();
+        }
+        catch(...) {
+            // fall back to portal calls
+        }
+    }
+    virtual ~LogSession() {
+        delete _prod;
+        delete _sm;
+        delete _ds;
     }
 
     /**
-     * Writes the given line to the log service. Note that the line should be short enough to fit
-     * into the Utcb!
+     * Writes the given line to the log service.
      *
      * @param line the line
      */
     void write(const String &line) {
+        write(line.str(), line.length());
+    }
+
+    /**
+     * Writes the given line to the log service. If the shared ring is full or too short for the
+     * line, it is sent via a portal call. Note that the line should be short enough to fit into
+     * the Utcb in this case!
+     *
+     * @param line the line
+     * @param len the length of the line
+     */
+    void write(const char *line, size_t len) {
+        if(_prod && len <= sizeof(_line.text)) {
+            _line.len = len;
+            memcpy(_line.text, line, len);
+            if(_prod->produce(_line))
+                return;
+        }
+
         UtcbFrame uf;
-        uf << line;
+        uf << WRITE << String(line, len);
         pt().call(uf);
     }
+
+private:
+    void share() {
+        ScopedCapSels caps(2, 2);
+        {
+            UtcbFrame uf;
+            uf.delegation_window(Crd(caps.get(), 1, Crd::OBJ_ALL));
+            uf << SHARE;
+            pt().call(uf);
+            uf.check_reply();
+        }
+        _ds = new DataSpace(caps.get());
+        _sm = new Sm(caps.get() + 1, false);
+        _prod = new MPSCProducer<Line>(*_ds, *_sm, false);
+        caps.release();
+    }
+
+    DataSpace *_ds;
+    Sm *_sm;
+    MPSCProducer<Line> *_prod;
+    Line _line;
 };
 
 }
@@ -19,7 +19,8 @@
 #include <arch/Types.h>
 #include <ipc/Connection.h>
 #include <ipc/PtClientSession.h>
-#include <ipc/Consumer.h>
+#include <ipc/MPSCConsumer.h>
+#include <ipc/Producer.h>
 #include <utcb/UtcbFrame.h>
 #include <util/DMA.h>
 #include <Exception.h>
@@ -38,6 +39,7 @@ public:
     static const size_t MAX_CONTROLLER      = 8;
     static const size_t MAX_DRIVES          = 32;   // per controller
     static const size_t MAX_DMA_DESCS       = 64;
+    static const size_t MAX_SUBMITS         = 32;   // size of the submission ring
 
     typedef DMADescList<MAX_DMA_DESCS> dma_type;
 
@@ -66,6 +68,16 @@ public:
         char name[64];
     };
 
+    /**
+     * A request in the submission ring
+     */
+    struct Request {
+        Command cmd;
+        tag_type tag;
+        sector_type sector;
+        dma_type dma;
+    };
+
     /**
      * Completion message
      */
@@ -82,7 +94,10 @@ private:
 };
 
 /**
- * Represents a session at the storage service
+ * Represents a session at the storage service. Besides the synchronous read(), write() and
+ * flush() methods, which cost a portal call per request, it offers a submission ring: you can
+ * put multiple requests into it via enqueue_*() and hand them over to the service at once via
+ * submit(). In both cases, the completion is reported via consumer().
  */
 class StorageSession : public PtClientSession {
     typedef Storage::tag_type tag_type;
@@ -99,14 +114,18 @@ public:
     explicit StorageSession(Connection &con, DataSpace &ds, size_t drive)
         : PtClientSession(con),
           _ctrlds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW), _sm(0),
-          _cons(_ctrlds, _sm, true) {
+          _cons(_ctrlds, _sm, true),
+          _subds(Math::round_up<size_t>((Storage::MAX_SUBMITS + 1) * sizeof(Storage::Request),
+                                        ExecEnv::PAGE_SIZE),
+                 DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW), _subsm(0),
+          _prod(_subds, _subsm, true) {
         init(ds, drive);
     }
 
     /**
      * @return the consumer to get notified about finished commands
      */
-    Consumer<Storage::Packet> &consumer() {
+    MPSCConsumer<Storage::Packet> &consumer() {
         return _cons;
     }
 
@@ -190,12 +209,71 @@ public:
         uf.check_reply();
     }
 
+    /**
+     * Puts a flush-request into the submission ring. Note that it is not passed to the service
+     * until you call submit().
+     *
+     * @param tag the tag to identify the command on completion
+     * @return true if successful, false if the submission ring is full
+     */
+    bool enqueue_flush(tag_type tag) {
+        return enqueue(Storage::FLUSH, tag, 0, nullptr);
+    }
+    /**
+     * Puts a read-request into the submission ring. Note that it is not passed to the service
+     * until you call submit(). Errors are reported via the status of the completion packet.
+     *
+     * @param tag the tag to identify the command on completion
+     * @param sector the start sector
+     * @param dma describes what to transfer where
+     * @return true if successful, false if the submission ring is full
+     */
+    bool enqueue_read(tag_type tag, sector_type sector, const Storage::dma_type &dma) {
+        return enqueue(Storage::READ, tag, sector, &dma);
+    }
+    /**
+     * Puts a write-request into the submission ring. Note that it is not passed to the service
+     * until you call submit(). Errors are reported via the status of the completion packet.
+     *
+     * @param tag the tag to identify the command on completion
+     * @param sector the start sector
+     * @param dma describes what to transfer where
+     * @return true if successful, false if the submission ring is full
+     */
+    bool enqueue_write(tag_type tag, sector_type sector, const Storage::dma_type &dma) {
+        return enqueue(Storage::WRITE, tag, sector, &dma);
+    }
+    /**
+     * Notifies the service that there are new requests in the submission ring
+     */
+    void submit() {
+        _prod.notify();
+    }
+
 private:
+    bool enqueue(Storage::Command cmd, tag_type tag, sector_type sector,
+                 const Storage::dma_type *dma) {
+        Storage::Request *req = _prod.current();
+        if(!req)
+            return false;
+        req->cmd = cmd;
+        req->tag = tag;
+        req->sector = sector;
+        if(dma)
+            req->dma = *dma;
+        else
+            req->dma.clear();
+        _prod.next(false);
+        return true;
+    }
+
     void init(DataSpace &ds, size_t drive) {
         UtcbFrame uf;
         uf.delegate(_ctrlds.sel(), 0);
         uf.delegate(ds.sel(), 1);
         uf.delegate(_sm.sel(), 2);
+        uf.delegate(_subds.sel(), 3);
+        uf.delegate(_subsm.sel(), 4);
         uf << Storage::INIT << drive;
         pt().call(uf);
         uf.check_reply();
@@ -204,7 +282,10 @@ private:
 
     DataSpace _ctrlds;
     Sm _sm;
-    Consumer<Storage::Packet> _cons;
+    MPSCConsumer<Storage::Packet> _cons;
+    DataSpace _subds;
+    Sm _subsm;
+    Producer<Storage::Request> _prod;
     Storage::Parameter _params;
 };
 
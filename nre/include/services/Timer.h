@@ -19,7 +19,11 @@
 #include <arch/Types.h>
 #include <ipc/Connection.h>
 #include <ipc/PtClientSession.h>
+#include <mem/DataSpace.h>
 #include <utcb/UtcbFrame.h>
+#include <util/ScopedCapSels.h>
+#include <util/Math.h>
+#include <util/Sync.h>
 #include <Exception.h>
 #include <CPU.h>
 
@@ -38,7 +42,24 @@ public:
     enum Command {
         GET_SMS,
         PROG_TIMER,
-        GET_TIME
+        GET_TIME,
+        GET_TIME_DS,
+        GET_STATS
+    };
+
+    /**
+     * The time page that is shared read-only with all clients. The timer service updates it
+     * periodically. The clients extrapolate the current time from it by means of the TSC.
+     */
+    struct TimeInfo {
+        // odd while the timer service updates the page
+        volatile word_t seq;
+        // the TSC frequency in Hz
+        timevalue_t tsc_freq;
+        // the TSC value at which <unixts> was taken
+        timevalue_t tsc;
+        // the unix timestamp in microseconds (WALLCLOCK_FREQ)
+        timevalue_t unixts;
     };
 
 private:
@@ -55,8 +76,9 @@ public:
      *
      * @param con the connection
      */
-    explicit TimerSession(Connection &con) : PtClientSession(con) {
+    explicit TimerSession(Connection &con) : PtClientSession(con), _timeds() {
         get_sms();
+        get_time_ds();
     }
     /**
      * Destroys this session
@@ -65,6 +87,7 @@ public:
         for(cpu_t cpu = 0; cpu < CPU::count(); ++cpu)
             delete _sms[cpu];
         delete[] _sms;
+        delete _timeds;
         CapSelSpace::get().free(_caps, 1 << CPU::order());
     }
 
@@ -82,18 +105,20 @@ public:
      * Waits for <cycles> cycles.
      *
      * @param cycles the number of cycles
+     * @param slack the number of cycles the wakeup may be delayed (see program())
      */
-    void wait_for(timevalue_t cycles) {
-        wait_until(Util::tsc() + cycles);
+    void wait_for(timevalue_t cycles, timevalue_t slack = 0) {
+        wait_until(Util::tsc() + cycles, slack);
     }
 
     /**
      * Waits until the TSC has the value <cycles>
      *
      * @param cycles the number of cycles
+     * @param slack the number of cycles the wakeup may be delayed (see program())
      */
-    void wait_until(timevalue_t cycles) {
-        program(cycles);
+    void wait_until(timevalue_t cycles, timevalue_t slack = 0) {
+        program(cycles, slack);
         _sms[CPU::current().log_id()]->zero();
     }
 
@@ -102,26 +127,55 @@ public:
      * get a signal.
      *
      * @param cycles the number of cycles
+     * @param slack the number of cycles by which the timer may fire later than <cycles>. This
+     *  allows the service to fire multiple timers with one interrupt.
      */
-    void program(timevalue_t cycles) {
+    void program(timevalue_t cycles, timevalue_t slack = 0) {
         UtcbFrame uf;
-        uf << Timer::PROG_TIMER << cycles;
+        uf << Timer::PROG_TIMER << cycles << slack;
         pt().call(uf);
         uf.check_reply();
     }
 
     /**
-     * Determines the current time
+     * Determines the current time. This does not involve the timer service, but reads the time
+     * page that it shares with us.
      *
      * @param uptime the time since systemstart in microseconds (Timer::WALLCLOCK_FREQ)
      * @param unixts the current unix timestamp in microseconds (Timer::WALLCLOCK_FREQ)
      */
-    void get_time(timevalue_t &uptime, timevalue_t &unixts) {
+    void get_time(timevalue_t &uptime, timevalue_t &unixts) const {
+        const Timer::TimeInfo *info = reinterpret_cast<const Timer::TimeInfo*>(_timeds->virt());
+        word_t seq;
+        do {
+            // wait until the timer service is done with updating it
+            while(EXPECT_FALSE((seq = info->seq) & 1))
+                Util::pause();
+            Sync::memory_barrier();
+
+            timevalue_t tsc = Util::tsc();
+            uptime = Math::muldiv128(tsc, Timer::WALLCLOCK_FREQ, info->tsc_freq);
+            // the TSCs of different CPUs might differ slightly
+            timevalue_t diff = tsc > info->tsc ? tsc - info->tsc : 0;
+            unixts = info->unixts + Math::muldiv128(diff, Timer::WALLCLOCK_FREQ, info->tsc_freq);
+
+            Sync::memory_barrier();
+        }
+        while(EXPECT_FALSE(seq != info->seq));
+    }
+
+    /**
+     * Determines the statistics of the timer service, summed up over all CPUs
+     *
+     * @param reprograms the number of times the hardware timer has been programmed
+     * @param coalesced the number of timeouts that have been fired together with another one
+     */
+    void get_stats(uint64_t &reprograms, uint64_t &coalesced) {
         UtcbFrame uf;
-        uf << Timer::GET_TIME;
+        uf << Timer::GET_STATS;
         pt().call(uf);
         uf.check_reply();
-        uf >> uptime >> unixts;
+        uf >> reprograms >> coalesced;
     }
 
 private:
@@ -138,8 +192,22 @@ private:
             _sms[it->log_id()] = new Sm(_caps + it->log_id(), true);
     }
 
+    void get_time_ds() {
+        ScopedCapSels cap;
+        {
+            UtcbFrame uf;
+            uf.delegation_window(Crd(cap.get(), 0, Crd::OBJ_ALL));
+            uf << Timer::GET_TIME_DS;
+            pt().call(uf);
+            uf.check_reply();
+        }
+        _timeds = new DataSpace(cap.get());
+        cap.release();
+    }
+
     capsel_t _caps;
     Sm **_sms;
+    DataSpace *_timeds;
 };
 
 }
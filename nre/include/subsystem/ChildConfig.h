@@ -17,6 +17,7 @@
 #pragma once
 
 #include <arch/Types.h>
+#include <stream/IStringStream.h>
 #include <util/CPUSet.h>
 
 namespace nre {
@@ -29,6 +30,7 @@ namespace nre {
 class ChildConfig {
 public:
     static const size_t MAX_WAITS       = 4;
+    static const size_t DEF_PREFAULT    = 32;
 
     enum ModuleAccess {
         OWN,                // access only to its own module
@@ -44,8 +46,8 @@ public:
      * @param cpu the CPU for the main thread
      */
     explicit ChildConfig(size_t no, const String &cmdline, cpu_t cpu = CPU::current().log_id())
-        : _no(no), _last(false), _modaccess(OWN), _cpu(cpu), _cpus(), _entry(0), _waitcount(),
-          _waits(), _cmdline() {
+        : _no(no), _last(false), _modaccess(OWN), _cpu(cpu), _cpus(), _entry(0),
+          _prefault(DEF_PREFAULT), _share_segments(false), _waitcount(), _waits(), _cmdline() {
         parse(cmdline);
     }
     virtual ~ChildConfig() {
@@ -105,6 +107,30 @@ public:
         _entry = entry;
     }
 
+    /**
+     * The number of pages to map initially when the child causes a pagefault. The number is
+     * adjusted per dataspace, depending on whether it is accessed sequentially or randomly.
+     */
+    size_t prefault() const {
+        return _prefault;
+    }
+    void prefault(size_t pages) {
+        _prefault = pages;
+    }
+
+    /**
+     * Whether the segments of the ELF file should be mapped directly instead of being copied into
+     * new dataspaces. Read-only segments are shared and writable segments are copied on write.
+     * This way, multiple childs that are loaded from the same ELF file share these pages. Note that
+     * it requires that the ELF file stays mapped as long as the child exists.
+     */
+    bool share_segments() const {
+        return _share_segments;
+    }
+    void share_segments(bool share) {
+        _share_segments = share;
+    }
+
     /**
      * Stores the module <i> that should be provided to the child into <mem>, if available.
      *
@@ -145,6 +171,8 @@ private:
                     _modaccess = ALL;
                 else if(strncmp(start, "lastmod", 7) == 0)
                     _last = true;
+                else if(strncmp(start, "prefault=", 9) == 0)
+                    _prefault = IStringStream::read_from<size_t>(start + 9, len - 9);
                 else if(strncmp(start, "provides=", 9) == 0 && _waitcount < MAX_WAITS)
                     _waits[_waitcount++] = String(start + 9, len - 9);
                 else {
@@ -166,6 +194,8 @@ private:
     cpu_t _cpu;
     CPUSet _cpus;
     uintptr_t _entry;
+    size_t _prefault;
+    bool _share_segments;
     size_t _waitcount;
     String _waits[MAX_WAITS];
     String _cmdline;
@@ -76,6 +76,28 @@ class ChildManager {
         PORTAL static void exception(capsel_t pid);
     };
 
+    /**
+     * Makes the switch sequence number odd while it exists and even again afterwards, even if
+     * the switch fails with an exception.
+     */
+    class ScopedSwitch {
+    public:
+        explicit ScopedSwitch(volatile size_t *seq) : _seq(seq) {
+            *_seq = *_seq + 1;
+            Sync::memory_barrier();
+        }
+        ~ScopedSwitch() {
+            Sync::memory_barrier();
+            *_seq = *_seq + 1;
+        }
+
+    private:
+        ScopedSwitch(const ScopedSwitch&);
+        ScopedSwitch& operator=(const ScopedSwitch&);
+
+        volatile size_t *_seq;
+    };
+
     /**
      * The different exit types
      */
@@ -220,6 +242,24 @@ private:
         return (pid - _portal_caps) % Hip::get().service_caps();
     }
 
+    /**
+     * Returns the current switch sequence number. It is odd while a switch is in progress, in
+     * which case we wait until it is finished. Pagefaults use it to detect whether a switch has
+     * changed the dataspace origins while they were handled.
+     */
+    size_t switch_seq() {
+        size_t seq;
+        while((seq = _switchseq) & 1) {
+            ScopedLock<UserSm> guard(&_switchsm);
+        }
+        Sync::memory_barrier();
+        return seq;
+    }
+    bool switch_seq_changed(size_t seq) const {
+        Sync::memory_barrier();
+        return _switchseq != seq;
+    }
+
     const ServiceRegistry::Service *get_service(const String &name) {
         ScopedLock<UserSm> guard(&_sm);
         const ServiceRegistry::Service* s = registry().find(name);
@@ -266,6 +306,7 @@ private:
     void map(UtcbFrameRef &uf, Child *c, DataSpace::RequestType type);
     void switch_to(UtcbFrameRef &uf, Child *c);
     void unmap(UtcbFrameRef &uf, Child *c);
+    void release_copies(const ChildMemory::DS *ds);
 
     ChildManager(const ChildManager&);
     ChildManager& operator=(const ChildManager&);
@@ -277,6 +318,7 @@ private:
     ServiceRegistry _registry;
     UserSm _sm;
     UserSm _switchsm;
+    volatile size_t _switchseq;
     mutable UserSm _slotsm;
     Sm _regsm;
     Sm _diesm;
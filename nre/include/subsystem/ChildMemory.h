@@ -22,10 +22,12 @@
 #include <mem/DataSpaceDesc.h>
 #include <stream/OStringStream.h>
 #include <collection/SortedSList.h>
+#include <collection/Treap.h>
 #include <bits/MaskField.h>
 #include <util/Math.h>
 #include <Exception.h>
 #include <Assert.h>
+#include <cstring>
 
 namespace nre {
 
@@ -52,19 +54,96 @@ public:
         RWX = R | W | X,
         // indicates that the memory has been requested by us, i.e. we haven't just joined the DS
         OWN = 1 << 4,
+        // the pages are shared with other childs and copied on the first write access
+        COW = DataSpaceDesc::COW,
     };
 
     /**
-     * A dataspace in the address space of the child including administrative information.
+     * The maximum number of pages to map at once for a pagefault
      */
-    class DS : public SListItem {
+    static const size_t MAX_PREFAULT    = ExecEnv::PT_ENTRY_COUNT;
+    /**
+     * The maximum number of pages to allocate at once for copy-on-write dataspaces
+     */
+    static const size_t COW_CHUNK       = 16;
+
+    class DS;
+
+    /**
+     * A piece of memory that holds the copies of the pages of a copy-on-write dataspace
+     */
+    class CowChunk : public SListItem {
+    public:
+        explicit CowChunk(const DataSpaceDesc &desc, capsel_t sel)
+            : SListItem(), _desc(desc), _sel(sel), _used() {
+        }
+
+        /**
+         * @return the dataspace descriptor
+         */
+        const DataSpaceDesc &desc() const {
+            return _desc;
+        }
+        /**
+         * @return the dataspace (unmap) capability
+         */
+        capsel_t sel() const {
+            return _sel;
+        }
+
+    private:
+        DataSpaceDesc _desc;
+        capsel_t _sel;
+        size_t _used;
+        friend class DS;
+    };
+
+    /**
+     * The node to put a dataspace into the tree that is indexed by the selector. Since a child
+     * can join a dataspace multiple times, there may be multiple dataspaces with the same
+     * selector. Only the first one is in the tree, the others are chained to it.
+     */
+    class SelNode : public TreapNode<capsel_t> {
+        friend class ChildMemory;
+
+    public:
+        explicit SelNode(capsel_t sel, DS *ds) : TreapNode<capsel_t>(sel), _ds(ds), _same() {
+        }
+
+        /**
+         * @return the dataspace
+         */
+        DS *ds() {
+            return _ds;
+        }
+
+    private:
+        DS *_ds;
+        SelNode *_same;
+    };
+
+    /**
+     * A dataspace in the address space of the child including administrative information. It is
+     * indexed by the virtual address in the child.
+     */
+    class DS : public SListItem, public TreapNode<uintptr_t> {
+        friend class ChildMemory;
+
     public:
         /**
          * Creates the dataspace with given descriptor and cap
          */
         explicit DS(const DataSpaceDesc &desc, capsel_t cap)
-            : SListItem(), _desc(desc), _cap(cap),
-              _perms(Math::blockcount<size_t>(desc.size(), ExecEnv::PAGE_SIZE) * 4) {
+            : SListItem(), TreapNode<uintptr_t>(desc.virt()), _desc(desc), _cap(cap),
+              _perms(Math::blockcount<size_t>(desc.size(), ExecEnv::PAGE_SIZE) * 4),
+              _selnode(cap, this), _window(), _next(), _copies(), _copycount(), _chunks() {
+        }
+        ~DS() {
+            for(auto it = _chunks.begin(); it != _chunks.end(); ) {
+                auto cur = it++;
+                delete &*cur;
+            }
+            delete[] _copies;
         }
 
         /**
@@ -96,7 +175,30 @@ public:
          * @return the origin for the given address
          */
         uintptr_t origin(uintptr_t addr) const {
-            return _desc.origin() + (addr - _desc.virt());
+            uintptr_t off = addr - _desc.virt();
+            if(_copies && _copies[off / ExecEnv::PAGE_SIZE])
+                return _copies[off / ExecEnv::PAGE_SIZE] + (off & (ExecEnv::PAGE_SIZE - 1));
+            return _desc.origin() + off;
+        }
+        /**
+         * Determines the biggest naturally aligned block around <addr> that can be mapped at
+         * once. That is, it has to be inside this dataspace and the origin has to be aligned
+         * in the same way.
+         *
+         * @param addr the virtual address (is expected to be in this dataspace)
+         * @param maxorder the maximum order (in pages)
+         * @return the order of the block (in pages)
+         */
+        uint max_order(uintptr_t addr, uint maxorder) const {
+            uintptr_t end = _desc.virt() + _desc.size();
+            for(uint order = maxorder; order > 0; --order) {
+                size_t size = static_cast<size_t>(1) << (order + ExecEnv::PAGE_SHIFT);
+                uintptr_t start = addr & ~(size - 1);
+                if(start >= _desc.virt() && start + size <= end &&
+                   (origin(start) & (size - 1)) == 0)
+                    return order;
+            }
+            return 0;
         }
         /**
          * @param addr the virtual address (is expected to be in this dataspace)
@@ -135,10 +237,121 @@ public:
             _perms.set_all(perms);
         }
 
+        /**
+         * Determines the number of pages to map for a pagefault at <addr>. If the fault is directly
+         * behind the pages that have been mapped last time, we assume a sequential access and
+         * double the number. Otherwise, we halve it. The hints SEQUENTIAL and RANDOM override that.
+         *
+         * @param addr the page-aligned fault address
+         * @param def the number of pages to start with
+         * @return the number of pages
+         */
+        size_t prefault_window(uintptr_t addr, size_t def) {
+            if(_desc.flags() & DataSpaceDesc::RANDOM)
+                return 1;
+            if(_desc.flags() & DataSpaceDesc::SEQUENTIAL)
+                return MAX_PREFAULT;
+            if(_window == 0)
+                _window = Math::min(Math::max<size_t>(def, 1), MAX_PREFAULT);
+            else if(addr == _next)
+                _window = Math::min(_window * 2, MAX_PREFAULT);
+            else
+                _window = Math::max<size_t>(_window / 2, 1);
+            return _window;
+        }
+        /**
+         * Remembers that the pages up to <end> have been mapped
+         *
+         * @param end the end of the mapped range
+         */
+        void prefaulted(uintptr_t end) {
+            _next = end;
+        }
+
+        /**
+         * @return whether the pages are shared with other childs and copied on the first write
+         */
+        bool is_cow() const {
+            return _desc.flags() & COW;
+        }
+        /**
+         * @param addr the virtual address (is expected to be in this dataspace)
+         * @return whether the page at <addr> has already been copied
+         */
+        bool copied(uintptr_t addr) const {
+            return _copies && _copies[(addr - _desc.virt()) / ExecEnv::PAGE_SIZE];
+        }
+        /**
+         * @return the number of copied pages
+         */
+        size_t copies() const {
+            return _copycount;
+        }
+        /**
+         * @return the chunks that hold the copies
+         */
+        const SList<CowChunk> &chunks() const {
+            return _chunks;
+        }
+        /**
+         * @return the number of pages a new chunk should have
+         */
+        size_t chunk_pages() const {
+            size_t pages = _desc.size() / ExecEnv::PAGE_SIZE;
+            return Math::min(pages - _copycount, COW_CHUNK);
+        }
+        /**
+         * Adds the given chunk to hold the copies.
+         *
+         * @param desc the dataspace descriptor of the chunk (desc.virt() is the address in the
+         *  parent (=us))
+         * @param sel the dataspace (unmap) capability
+         */
+        void add_chunk(const DataSpaceDesc &desc, capsel_t sel) {
+            _chunks.append(new CowChunk(desc, sel));
+        }
+        /**
+         * @return whether there is a free page in the last chunk, i.e. whether copy() succeeds
+         */
+        bool can_copy() const {
+            if(_chunks.length() == 0)
+                return false;
+            const CowChunk *chunk = &*_chunks.tail();
+            return chunk->_used < chunk->desc().size() / ExecEnv::PAGE_SIZE;
+        }
+        /**
+         * Copies the page at <addr> into a free page of the last chunk and uses the copy from now
+         * on as the origin of the page.
+         *
+         * @param addr the virtual address (is expected to be in this dataspace)
+         * @return true on success, false if there is no free page (use add_chunk() first)
+         */
+        bool copy(uintptr_t addr) {
+            if(!can_copy())
+                return false;
+            CowChunk *chunk = &*_chunks.tail();
+            if(!_copies)
+                _copies = new uintptr_t[_desc.size() / ExecEnv::PAGE_SIZE]();
+
+            uintptr_t page = chunk->desc().virt() + chunk->_used++ * ExecEnv::PAGE_SIZE;
+            uintptr_t pgaddr = addr & ~(ExecEnv::PAGE_SIZE - 1);
+            memcpy(reinterpret_cast<void*>(page), reinterpret_cast<void*>(origin(pgaddr)),
+                   ExecEnv::PAGE_SIZE);
+            _copies[(pgaddr - _desc.virt()) / ExecEnv::PAGE_SIZE] = page;
+            _copycount++;
+            return true;
+        }
+
     private:
         DataSpaceDesc _desc;
         capsel_t _cap;
         MaskField<4> _perms;
+        SelNode _selnode;
+        size_t _window;
+        uintptr_t _next;
+        uintptr_t *_copies;
+        size_t _copycount;
+        SList<CowChunk> _chunks;
     };
 
     typedef SList<DS>::const_iterator iterator;
@@ -146,7 +359,8 @@ public:
     /**
      * Constructor
      */
-    explicit ChildMemory() : _list(isless) {
+    explicit ChildMemory()
+        : _list(isless), _addrtree(), _seltree(), _prefault(1), _faults(), _prefaulted() {
     }
     /**
      * Destructor
@@ -171,9 +385,48 @@ public:
             virt += it->desc().size();
             if(it->desc().type() != DataSpaceDesc::VIRTUAL && (it->desc().flags() & OWN))
                 phys += it->desc().size();
+            phys += it->copies() * ExecEnv::PAGE_SIZE;
         }
     }
 
+    /**
+     * @return the number of pages to map initially for a pagefault
+     */
+    size_t prefault() const {
+        return _prefault;
+    }
+    /**
+     * Sets the number of pages to map initially for a pagefault
+     *
+     * @param pages the number of pages
+     */
+    void prefault(size_t pages) {
+        _prefault = pages;
+    }
+
+    /**
+     * @return the number of pagefaults that have been handled
+     */
+    size_t faults() const {
+        return _faults;
+    }
+    /**
+     * @return the number of pages that have been mapped in addition to the faulting pages
+     */
+    size_t prefaulted() const {
+        return _prefaulted;
+    }
+    /**
+     * Accounts a pagefault that has been handled by mapping <pages> pages
+     *
+     * @param pages the number of mapped pages (0 if it was already mapped)
+     */
+    void fault_handled(size_t pages) {
+        _faults++;
+        if(pages > 1)
+            _prefaulted += pages - 1;
+    }
+
     /**
      * @return the first dataspace
      */
@@ -203,10 +456,10 @@ public:
      * @return the dataspace or nullptr if not found
      */
     DS *find_by_addr(uintptr_t addr) {
-        for(auto it = _list.begin(); it != _list.end(); ++it) {
-            if(addr >= it->desc().virt() && addr < it->desc().virt() + it->desc().size())
-                return &*it;
-        }
+        // the dataspaces don't overlap. so, it can only be the one that starts last before addr
+        DS *ds = _addrtree.find_floor(addr);
+        if(ds && addr < ds->desc().virt() + ds->desc().size())
+            return ds;
         return nullptr;
     }
 
@@ -246,6 +499,9 @@ public:
         DS *ds = new DS(DataSpaceDesc(desc.size(), desc.type(), flags, desc.phys(), addr,
                                       desc.virt()), sel);
         _list.insert(ds);
+        _addrtree.insert(ds);
+        if(sel != ObjCap::INVALID)
+            add_sel(&ds->_selnode);
     }
 
     /**
@@ -273,17 +529,42 @@ public:
 
 private:
     DS *get(capsel_t sel) {
-        for(auto it = _list.begin(); it != _list.end(); ++it) {
-            if(it->cap() == sel)
-                return &*it;
+        SelNode *node = _seltree.find(sel);
+        return node ? node->ds() : nullptr;
+    }
+    void add_sel(SelNode *node) {
+        SelNode *first = _seltree.find(node->key());
+        if(first) {
+            while(first->_same)
+                first = first->_same;
+            first->_same = node;
         }
-        return nullptr;
+        else
+            _seltree.insert(node);
+    }
+    void remove_sel(SelNode *node) {
+        SelNode *first = _seltree.find(node->key());
+        if(first == node) {
+            // let the next one with the same selector take our place in the tree
+            _seltree.remove(node);
+            if(node->_same)
+                _seltree.insert(node->_same);
+        }
+        else {
+            while(first->_same != node)
+                first = first->_same;
+            first->_same = node->_same;
+        }
+        node->_same = nullptr;
     }
     DataSpaceDesc remove(DS *ds, capsel_t *sel) {
         DataSpaceDesc desc;
         if(!ds)
             throw ChildMemoryException(E_NOT_FOUND, "Dataspace not found");
         _list.remove(ds);
+        _addrtree.remove(ds);
+        if(ds->cap() != ObjCap::INVALID)
+            remove_sel(&ds->_selnode);
         if(sel)
             *sel = ds->cap();
         desc = ds->desc();
@@ -295,7 +576,13 @@ private:
         return a.desc().virt() < b.desc().virt();
     }
 
+    // the list is used for iteration, the trees for the lookups
     SortedSList<DS> _list;
+    Treap<DS> _addrtree;
+    Treap<SelNode> _seltree;
+    size_t _prefault;
+    size_t _faults;
+    size_t _prefaulted;
 };
 
 OStream &operator<<(OStream &os, const ChildMemory &cm);
@@ -32,6 +32,8 @@ namespace nre {
 class Pt;
 class UtcbFrameRef;
 class UtcbExcFrameRef;
+template<typename T>
+struct UtcbMarshaller;
 OStream &operator<<(OStream &os, const Utcb &utcb);
 OStream &operator<<(OStream &os, const UtcbFrameRef &frm);
 OStream &operator<<(OStream &os, const UtcbExc::Descriptor &desc);
@@ -422,7 +424,7 @@ public:
 
     /**
      * Writes the given object as untyped item into the UTCB frame. Note that there might not be
-     * enough space left in the UTCB.
+     * enough space left in the UTCB. How the object is written is determined by UtcbMarshaller<T>.
      *
      * @param value the object to write
      * @return *this
@@ -430,6 +432,18 @@ public:
      */
     template<typename T>
     UtcbFrameRef & operator<<(const T& value) {
+        UtcbMarshaller<T>::write(*this, value);
+        return *this;
+    }
+    /**
+     * Writes the given object as it is into the UTCB frame, i.e. all sizeof(T) bytes.
+     *
+     * @param value the object to write
+     * @return *this
+     * @throws UtcbException if there is not enough space
+     */
+    template<typename T>
+    UtcbFrameRef & write_raw(const T& value) {
         const size_t words = (sizeof(T) + sizeof(word_t) - 1) / sizeof(word_t);
         check_untyped_write(words);
         assert(Utcb::get_current_frame(_utcb->base()) == _utcb);
@@ -449,7 +463,7 @@ public:
 
     /**
      * Reads the next untyped item from the UTCB frame. Of course, you need to know what object you
-     * receive.
+     * receive. How the object is read is determined by UtcbMarshaller<T>.
      *
      * @param value the place to write to
      * @return *this
@@ -457,6 +471,18 @@ public:
      */
     template<typename T>
     UtcbFrameRef & operator>>(T &value) {
+        UtcbMarshaller<T>::read(*this, value);
+        return *this;
+    }
+    /**
+     * Reads the next untyped item from the UTCB frame, that has been written by write_raw().
+     *
+     * @param value the place to write to
+     * @return *this
+     * @throws UtcbException if there is no untyped item anymore
+     */
+    template<typename T>
+    UtcbFrameRef & read_raw(T &value) {
         const size_t words = (sizeof(T) + sizeof(word_t) - 1) / sizeof(word_t);
         check_untyped_read(words);
         value = *reinterpret_cast<T*>(_utcb->msg + _upos);
@@ -493,6 +519,21 @@ protected:
     size_t _tpos;
 };
 
+/**
+ * Determines how objects of type T are transferred via UTCB frames. By default, the object is
+ * copied as it is. Specialize it for types that should be transferred differently, e.g. to
+ * transfer only the used part of a container.
+ */
+template<typename T>
+struct UtcbMarshaller {
+    static void write(UtcbFrameRef &uf, const T &value) {
+        uf.write_raw(value);
+    }
+    static void read(UtcbFrameRef &uf, T &value) {
+        uf.read_raw(value);
+    }
+};
+
 /**
  * The UtcbFrame creates a new frame in the UTCB.
  */
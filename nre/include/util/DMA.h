@@ -190,29 +190,28 @@ static inline OStream &operator<<(OStream &os, const DMADescList<MAX> &l) {
 }
 
 /**
- * Writes the list into the UTCB. Note that the UTCB size is limited!
+ * Transfers only the used descriptors of the list via the UTCB. Note that the UTCB size is
+ * limited!
  */
 template<size_t MAX>
-static inline UtcbFrameRef &operator<<(UtcbFrameRef &uf, const DMADescList<MAX> &l) {
-    uf << l.count();
-    for(typename DMADescList<MAX>::iterator it = l.begin(); it != l.end(); ++it)
-        uf << *it;
-    return uf;
-}
-/**
- * Reads the list back from the UTCB
- */
-template<size_t MAX>
-static inline UtcbFrameRef &operator>>(UtcbFrameRef &uf, DMADescList<MAX> &l) {
-    size_t count;
-    uf >> count;
-    l.clear();
-    while(count-- > 0) {
-        DMADesc desc;
-        uf >> desc;
-        l.push(desc);
-    }
-    return uf;
-}
+struct UtcbMarshaller<DMADescList<MAX> > {
+    static void write(UtcbFrameRef &uf, const DMADescList<MAX> &l) {
+        uf.write_raw(l.count());
+        for(typename DMADescList<MAX>::iterator it = l.begin(); it != l.end(); ++it)
+            uf.write_raw(*it);
+    }
+    static void read(UtcbFrameRef &uf, DMADescList<MAX> &l) {
+        size_t count;
+        uf.read_raw(count);
+        if(count > MAX)
+            VTHROW(UtcbException, E_ARGS_INVALID, "Too many DMA descriptors (" << count << ")");
+        l.clear();
+        while(count-- > 0) {
+            DMADesc desc;
+            uf.read_raw(desc);
+            l.push(desc);
+        }
+    }
+};
 
 }
@@ -79,14 +79,29 @@ public:
     }
 
     /**
-     * Program the nr-th MSI/MSI-X vector of the given device.
+     * Determines the number of MSI-X vectors the given device supports.
+     *
+     * @param bdf the device
+     * @return the number of vectors (0 if MSI-X is not supported)
      */
-    Gsi *get_gsi_msi(BDF bdf, uint nr, void *msix_table = nullptr);
+    uint msix_vectors(BDF bdf) {
+        size_t msix_offset = find_cap(bdf, CAP_MSIX);
+        if(!msix_offset)
+            return 0;
+        return ((conf_read(bdf, msix_offset) >> 16) & 0x7FF) + 1;
+    }
+
+    /**
+     * Program the nr-th MSI/MSI-X vector of the given device and route it to the given CPU.
+     */
+    Gsi *get_gsi_msi(BDF bdf, uint nr, void *msix_table = nullptr,
+                     cpu_t cpu = CPU::current().log_id());
 
     /**
-     * Returns the gsi and enables them.
+     * Returns the gsi, routed to the given CPU, and enables them.
      */
-    Gsi *get_gsi(BDF bdf, uint nr, bool /*level*/ = false, void *msix_table = nullptr);
+    Gsi *get_gsi(BDF bdf, uint nr, bool /*level*/ = false, void *msix_table = nullptr,
+                 cpu_t cpu = CPU::current().log_id());
 
 private:
     void init_msix_table(void *addr, BDF bdf, value_type msix_offset, uint nr, Gsi *gsi) {
@@ -34,14 +34,14 @@ public:
      * @param align the alignment
      */
     explicit ScopedCapSels(uint count = 1, uint align = 1)
-        : _cap(CapSelSpace::get().allocate(count, align)), _count(count), _owned(true) {
+        : _cap(CapSelSpace::get().allocate(count, align)), _count(count), _align(align), _owned(true) {
     }
     /**
      * Destructor. Free's the cap selectors, as soon as you haven't called release().
      */
     ~ScopedCapSels() {
         if(_owned)
-            CapSelSpace::get().free(_cap, _count);
+            CapSelSpace::get().free(_cap, _count, _align);
     }
 
     /**
@@ -69,6 +69,7 @@ private:
 private:
     capsel_t _cap;
     uint _count;
+    uint _align;
     bool _owned;
 };
 
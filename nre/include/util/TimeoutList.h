@@ -31,42 +31,216 @@ public:
 };
 
 /**
- * Keeping track of the timeouts.
+ * Keeps the programmed timeouts in a sorted list. That is, requesting a timeout takes O(n), but
+ * the head is found in O(1). This is the best choice for a small number of entries.
+ * Entry 0 is reserved and used as the list head.
  */
-template<unsigned ENTRIES, typename DATA>
-class TimeoutList {
-    class TimeoutEntry {
-        friend class TimeoutList<ENTRIES, DATA>;
-        TimeoutEntry *_next;
-        TimeoutEntry *_prev;
+template<unsigned ENTRIES>
+class TimeoutSortedList {
+    struct Entry {
+        Entry *_next;
+        Entry *_prev;
         timevalue_t _timeout;
-        DATA * data;
-        bool _free;
     };
 
 public:
-    explicit TimeoutList() : _entries() {
+    explicit TimeoutSortedList() : _entries() {
         for(size_t i = 0; i < ENTRIES; i++) {
             _entries[i]._prev = _entries + i;
             _entries[i]._next = _entries + i;
-            _entries[i].data = nullptr;
-            _entries[i]._free = true;
         }
         _entries[0]._timeout = ~0ULL;
     }
 
+    /**
+     * @return whether entry <nr> is programmed
+     */
+    bool queued(size_t nr) const {
+        return _entries[nr]._next != _entries + nr;
+    }
+    /**
+     * Programs entry <nr> to timeout <to>. If it is already programmed, it is moved.
+     */
+    void insert(size_t nr, timevalue_t to) {
+        Entry *current = _entries + nr;
+        if(queued(nr))
+            remove(nr);
+
+        // keep a sorted list here
+        Entry *t = _entries;
+        do {
+            t = t->_next;
+        }
+        while(t->_timeout < to);
+
+        current->_timeout = to;
+        current->_next = t;
+        current->_prev = t->_prev;
+        t->_prev->_next = current;
+        t->_prev = current;
+    }
+    /**
+     * Removes the programmed entry <nr>
+     */
+    void remove(size_t nr) {
+        Entry *current = _entries + nr;
+        current->_next->_prev = current->_prev;
+        current->_prev->_next = current->_next;
+        current->_next = current->_prev = current;
+    }
+    /**
+     * @return the entry with the earliest timeout (0 if there is none)
+     */
+    size_t head() const {
+        return _entries[0]._next - _entries;
+    }
+    /**
+     * @return the earliest timeout (~0ULL if there is none)
+     */
+    timevalue_t timeout() const {
+        return _entries[0]._next->_timeout;
+    }
+
+private:
+    Entry _entries[ENTRIES];
+};
+
+/**
+ * Keeps the programmed timeouts in a binary min-heap, which stores the position of every entry in
+ * the heap. Thus, requesting and cancelling a timeout takes O(log n) and the head is found in
+ * O(1). This is the better choice for a large number of entries.
+ */
+template<unsigned ENTRIES>
+class TimeoutHeap {
+public:
+    explicit TimeoutHeap() : _count(), _heap(), _pos(), _timeouts() {
+    }
+
+    /**
+     * @return whether entry <nr> is programmed
+     */
+    bool queued(size_t nr) const {
+        return _pos[nr] != 0;
+    }
+    /**
+     * Programs entry <nr> to timeout <to>. If it is already programmed, it is moved.
+     */
+    void insert(size_t nr, timevalue_t to) {
+        if(!queued(nr)) {
+            _heap[_count] = nr;
+            _pos[nr] = ++_count;
+        }
+        timevalue_t old = _timeouts[nr];
+        _timeouts[nr] = to;
+        // note that new entries have to be moved upwards
+        if(to <= old || _pos[nr] == _count)
+            up(_pos[nr] - 1);
+        else
+            down(_pos[nr] - 1);
+    }
+    /**
+     * Removes the programmed entry <nr>
+     */
+    void remove(size_t nr) {
+        size_t i = _pos[nr] - 1;
+        _pos[nr] = 0;
+        if(i == --_count)
+            return;
+        // put the last one into the hole and restore the heap property
+        _heap[i] = _heap[_count];
+        _pos[_heap[i]] = i + 1;
+        if(i > 0 && _timeouts[_heap[i]] < _timeouts[_heap[(i - 1) / 2]])
+            up(i);
+        else
+            down(i);
+    }
+    /**
+     * @return the entry with the earliest timeout (0 if there is none)
+     */
+    size_t head() const {
+        return _count ? _heap[0] : 0;
+    }
+    /**
+     * @return the earliest timeout (~0ULL if there is none)
+     */
+    timevalue_t timeout() const {
+        return _count ? _timeouts[_heap[0]] : ~0ULL;
+    }
+
+private:
+    void up(size_t i) {
+        size_t nr = _heap[i];
+        while(i > 0) {
+            size_t parent = (i - 1) / 2;
+            if(_timeouts[_heap[parent]] <= _timeouts[nr])
+                break;
+            move(i, _heap[parent]);
+            i = parent;
+        }
+        move(i, nr);
+    }
+    void down(size_t i) {
+        size_t nr = _heap[i];
+        while(true) {
+            size_t child = 2 * i + 1;
+            if(child >= _count)
+                break;
+            if(child + 1 < _count && _timeouts[_heap[child + 1]] < _timeouts[_heap[child]])
+                child++;
+            if(_timeouts[nr] <= _timeouts[_heap[child]])
+                break;
+            move(i, _heap[child]);
+            i = child;
+        }
+        move(i, nr);
+    }
+    void move(size_t i, size_t nr) {
+        _heap[i] = nr;
+        _pos[nr] = i + 1;
+    }
+
+    size_t _count;
+    // the entries in heap order
+    size_t _heap[ENTRIES];
+    // the position in _heap + 1 for each entry (0 = not programmed)
+    size_t _pos[ENTRIES];
+    timevalue_t _timeouts[ENTRIES];
+};
+
+/**
+ * Keeping track of the timeouts. The entries are allocated from a free-list, whereas the order of
+ * the programmed timeouts is maintained by <QUEUE>, which is either TimeoutSortedList or
+ * TimeoutHeap. Note that entry 0 is never handed out.
+ */
+template<unsigned ENTRIES, typename DATA, class QUEUE = TimeoutSortedList<ENTRIES> >
+class TimeoutList {
+    struct Entry {
+        DATA *data;
+        // the next free entry (0 = none)
+        size_t next_free;
+        bool free;
+    };
+
+public:
+    explicit TimeoutList() : _queue(), _entries(), _free(ENTRIES > 1 ? 1 : 0) {
+        for(size_t i = 0; i < ENTRIES; i++) {
+            _entries[i].data = nullptr;
+            _entries[i].next_free = i + 1 < ENTRIES ? i + 1 : 0;
+            _entries[i].free = true;
+        }
+    }
+
     /**
      * Alloc a new timeout object.
      */
     size_t alloc(DATA *data = nullptr) {
-        for(size_t i = 1; i < ENTRIES; i++) {
-            if(!_entries[i]._free)
-                continue;
-            _entries[i].data = data;
-            _entries[i]._free = false;
-            return i;
-        }
-        throw TimeoutListException(E_CAPACITY, "No free timeout slots");
+        size_t i = _free;
+        if(i == 0)
+            throw TimeoutListException(E_CAPACITY, "No free timeout slots");
+        _free = _entries[i].next_free;
+        _entries[i].data = data;
+        _entries[i].free = false;
+        return i;
     }
 
     /**
@@ -74,14 +248,16 @@ public:
      */
     bool dealloc(size_t nr, bool withcancel = false) {
         assert(nr >= 1 && nr <= ENTRIES - 1);
-        if(_entries[nr]._free)
+        if(_entries[nr].free)
             return false;
 
         // should only be done when no no concurrent access happens ...
         if(withcancel)
             cancel(nr);
-        _entries[nr]._free = true;
+        _entries[nr].free = true;
         _entries[nr].data = nullptr;
+        _entries[nr].next_free = _free;
+        _free = nr;
         return true;
     }
 
@@ -90,13 +266,10 @@ public:
      */
     bool cancel(size_t nr) {
         assert(nr >= 1 && nr <= ENTRIES - 1);
-        TimeoutEntry *current = _entries + nr;
-        if(current->_next == current)
+        if(!_queue.queued(nr))
             return false;
-        bool res = _entries[0]._next != current;
-        current->_next->_prev = current->_prev;
-        current->_prev->_next = current->_next;
-        current->_next = current->_prev = current;
+        bool res = _queue.head() != nr;
+        _queue.remove(nr);
         return res;
     }
 
@@ -106,21 +279,7 @@ public:
     bool request(size_t nr, timevalue_t to) {
         assert(nr >= 1 && nr <= ENTRIES - 1);
         timevalue_t old = timeout();
-        TimeoutEntry *current = _entries + nr;
-        cancel(nr);
-
-        // keep a sorted list here
-        TimeoutEntry *t = _entries;
-        do {
-            t = t->_next;
-        }
-        while(t->_timeout < to);
-
-        current->_timeout = to;
-        current->_next = t;
-        current->_prev = t->_prev;
-        t->_prev->_next = current;
-        t->_prev = current;
+        _queue.insert(nr, to);
         return timeout() == old;
     }
 
@@ -129,7 +288,7 @@ public:
      */
     size_t trigger(timevalue_t now, DATA **data = nullptr) {
         if(now >= timeout()) {
-            size_t i = _entries[0]._next - _entries;
+            size_t i = _queue.head();
             if(data)
                 *data = _entries[i].data;
             return i;
@@ -138,12 +297,13 @@ public:
     }
 
     timevalue_t timeout() {
-        assert(_entries[0]._next);
-        return _entries[0]._next->_timeout;
+        return _queue.timeout();
     }
 
 private:
-    TimeoutEntry _entries[ENTRIES];
+    QUEUE _queue;
+    Entry _entries[ENTRIES];
+    size_t _free;
 };
 
 }
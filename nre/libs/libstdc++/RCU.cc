@@ -15,7 +15,11 @@
  */
 
 #include <arch/Startup.h>
+#include <kobj/GlobalThread.h>
+#include <kobj/Sm.h>
+#include <util/Clock.h>
 #include <RCU.h>
+#include <CPU.h>
 
 namespace nre {
 
@@ -26,13 +30,44 @@ class Init {
     static Init init;
 };
 
-uint32_t *RCU::_versions = nullptr;
-size_t RCU::_versions_count = 0;
-SList<Thread> RCU::_ecs;
+size_t RCU::_epoch = 0;
 RCUObject *RCU::_objs = nullptr;
 RCULock RCU::_lock;
 UserSm RCU::_sm INIT_PRIO_RCU;
-UserSm RCU::_ecsm INIT_PRIO_RCU;
+RCU::ThreadList RCU::_threads[Hip::MAX_CPUS] INIT_PRIO_RCU;
+UserSm RCU::_reclaimsm INIT_PRIO_RCU(0);
+bool RCU::_reclaimer_started = false;
 Init Init::init INIT_PRIO_RCU;
 
+void RCU::notify_reclaimer() {
+    bool start = false;
+    {
+        ScopedLock<UserSm> guard(&_sm);
+        if(!_reclaimer_started) {
+            _reclaimer_started = true;
+            start = true;
+        }
+    }
+    if(start) {
+        GlobalThread *gt = GlobalThread::create(reclaimer, CPU::current().log_id(), "rcu-reclaimer");
+        gt->start();
+    }
+    _reclaimsm.up();
+}
+
+void RCU::reclaimer(void*) {
+    // readers don't tell us when they leave their read section. so, check periodically whether
+    // the grace periods are over and block in between. this way, a thread that blocks in a read
+    // section doesn't make us burn the CPU.
+    Clock clock(RECLAIM_FREQ);
+    Sm sm(0);
+    while(true) {
+        _reclaimsm.down();
+        // wait until all objects that have been invalidated so far are deleted. since we do that
+        // for all objects at once, multiple invalidations are handled in one batch.
+        while(collect())
+            sm.zero_until(clock.source_time(1));
+    }
+}
+
 }
@@ -16,9 +16,105 @@
 
 #include <arch/Startup.h>
 #include <cap/CapSelSpace.h>
+#include <kobj/Thread.h>
+#include <Syscalls.h>
 
 namespace nre {
 
 CapSelSpace CapSelSpace::_inst INIT_PRIO_CAPSPACE;
 
+CapSelSpace::CPUCache *CapSelSpace::cache() {
+    // during startup, there might be no thread yet
+    Thread *t = Thread::current();
+    return t ? _caches + t->cpu() : nullptr;
+}
+
+capsel_t CapSelSpace::allocate(uint count, uint align) {
+    uint order = order_of(count > align ? count : align);
+    if(order < CACHE_ORDERS) {
+        CPUCache *c = cache();
+        if(c) {
+            ScopedLock<SpinLock> lock(&c->lck);
+            if(c->count[order] > 0)
+                return c->blocks[order][--c->count[order]];
+        }
+    }
+
+    ScopedLock<SpinLock> lock(&_lck);
+    return allocate_block(order);
+}
+
+void CapSelSpace::free(capsel_t base, uint count, uint align) {
+    uint order = order_of(count > align ? count : align);
+    // the selectors might still refer to capabilities (e.g., if they have been delegated to us and
+    // we didn't destroy the object). since NOVA doesn't overwrite an occupied selector, the next
+    // user of the block would silently get the old capability. so, make sure that it is empty.
+    Syscalls::revoke(Crd(base, order, Crd::OBJ_ALL), true);
+    if(order < CACHE_ORDERS) {
+        CPUCache *c = cache();
+        if(c) {
+            ScopedLock<SpinLock> lock(&c->lck);
+            if(c->count[order] < CACHE_SIZE) {
+                c->blocks[order][c->count[order]++] = base;
+                return;
+            }
+        }
+    }
+
+    ScopedLock<SpinLock> lock(&_lck);
+    free_block(base, order);
+}
+
+capsel_t CapSelSpace::allocate_block(uint order) {
+    // is there a free block of that size?
+    if(order < FREE_ORDERS && _free[order].count > 0)
+        return _free[order].blocks[--_free[order].count];
+
+    // otherwise split the smallest larger one
+    for(uint o = order + 1; o < FREE_ORDERS; ++o) {
+        if(_free[o].count > 0) {
+            capsel_t res = _free[o].blocks[--_free[o].count];
+            while(o-- > order)
+                free_block(res + (1U << o), o);
+            return res;
+        }
+    }
+
+    // take it from the never used selectors
+    capsel_t size = 1U << order;
+    capsel_t res = (_off + size - 1) & ~(size - 1);
+    if(res + size < res || res + size > Hip::get().cfg_cap)
+        throw CapException(E_NO_CAP_SELS);
+    // put the selectors we skip due to the alignment into the free lists
+    while(_off < res) {
+        uint o = 0;
+        while(!(_off & (1U << o)) && _off + (2U << o) <= res)
+            o++;
+        free_block(_off, o);
+        _off += 1U << o;
+    }
+    _off = res + size;
+    return res;
+}
+
+void CapSelSpace::free_block(capsel_t base, uint order) {
+    // merge it with its buddy, if that is free as well
+    while(order + 1 < FREE_ORDERS) {
+        BlockList &list = _free[order];
+        capsel_t buddy = base ^ (1U << order);
+        uint i;
+        for(i = 0; i < list.count && list.blocks[i] != buddy; ++i)
+            ;
+        if(i == list.count)
+            break;
+        list.blocks[i] = list.blocks[--list.count];
+        base &= ~(1U << order);
+        order++;
+    }
+
+    // if there is no space left, we simply lose the selectors
+    if(order < FREE_ORDERS && _free[order].count < FREE_SIZE)
+        _free[order].blocks[_free[order].count++] = base;
+}
+
 }
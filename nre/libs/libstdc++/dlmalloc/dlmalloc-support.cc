@@ -78,9 +78,10 @@ void semaphore_up(DlMallocSm *lk) {
 // Backend allocator
 
 void *mmap(void *, size_t size, int prot, int, int, off_t) {
-    DataSpaceDesc desc(size, DataSpaceDesc::ANONYMOUS, prot);
+    DataSpaceDesc desc(size, DataSpaceDesc::ANONYMOUS, prot | DataSpaceDesc::ZEROED);
     DataSpace::create(desc);
-    memset(reinterpret_cast<void*>(desc.virt()), 0, desc.size());
+    if(!(desc.flags() & DataSpaceDesc::ZEROED))
+        memset(reinterpret_cast<void*>(desc.virt()), 0, desc.size());
     return reinterpret_cast<void*>(desc.virt());
 }
 
@@ -21,14 +21,35 @@ namespace nre {
 
 ServiceSession *Service::new_session(capsel_t cap) {
     ScopedLock<UserSm> guard(&_sm);
-    for(size_t i = 0; i < MAX_SESSIONS; ++i) {
-        if(_sessions[i] == nullptr) {
-            LOG(SERVICES, "Creating session " << i << " (caps=" << _caps + (i << CPU::order()) << ")\n");
-            add_session(create_session(i, cap, _caps + (i << CPU::order()), _func));
-            return _sessions[i];
+    static const word_t full = ~static_cast<word_t>(0) >> (sizeof(word_t) * 8 - SESSION_CHUNK_SIZE);
+    SessionChunk *chunk = nullptr;
+    size_t c;
+    for(c = 0; c < _chunk_count; ++c) {
+        if(_chunks[c]->used != full) {
+            chunk = _chunks[c];
+            break;
         }
     }
-    throw ServiceException(E_CAPACITY, "No free sessions");
+    if(!chunk)
+        chunk = add_chunk();
+
+    size_t idx = Math::bit_scan_forward(~chunk->used);
+    size_t id = (c << SESSION_CHUNK_ORDER) + idx;
+    capsel_t caps = chunk->caps + (idx << CPU::order());
+    LOG(SERVICES, "Creating session " << id << " (caps=" << caps << ")\n");
+    add_session(chunk, create_session(id, cap, caps, _func));
+    return chunk->sessions[idx];
+}
+
+Service::SessionChunk *Service::add_chunk() {
+    if(_chunk_count == MAX_SESSION_CHUNKS)
+        throw ServiceException(E_CAPACITY, "No free sessions");
+    size_t first = _chunk_count << SESSION_CHUNK_ORDER;
+    SessionChunk *chunk = new SessionChunk(_caps + (first << CPU::order()));
+    // make the chunk visible before the count
+    rcu_assign_pointer(_chunks[_chunk_count], chunk);
+    rcu_assign_pointer(_chunk_count, _chunk_count + 1);
+    return chunk;
 }
 
 void Service::check_sessions() {
@@ -64,9 +85,11 @@ void Service::check_sessions() {
 
 void Service::destroy_session(capsel_t pid) {
     ScopedLock<UserSm> guard(&_sm);
-    size_t i = (pid - _caps) >> CPU::order();
+    size_t i = session_id(pid);
     LOG(SERVICES, "Destroying session " << i << "\n");
-    ServiceSession *sess = _sessions[i];
+    ServiceSession *sess = nullptr;
+    if((i >> SESSION_CHUNK_ORDER) < _chunk_count)
+        sess = _chunks[i >> SESSION_CHUNK_ORDER]->sessions[i & (SESSION_CHUNK_SIZE - 1)];
     if(!sess)
         VTHROW(ServiceException, E_NOT_FOUND, "Session " << i << " does not exist");
     remove_session(sess);
@@ -30,7 +30,7 @@ ServiceCPUHandler::ServiceCPUHandler(Service* s, capsel_t pt, cpu_t cpu)
     _service_ec->set_tls<Service*>(Thread::TLS_PARAM, s);
     UtcbFrameRef ecuf(_service_ec->utcb());
     // for session-identification
-    ecuf.accept_translates(s->_caps, Service::MAX_SESSIONS_ORDER + CPU::order());
+    ecuf.accept_translates(s->caps(), Service::MAX_SESSIONS_ORDER + CPU::order());
     ecuf.accept_delegates(0);
 }
 
@@ -15,11 +15,73 @@
  */
 
 #include <arch/Defines.h>
+#include <Compiler.h>
 #include <cstring>
 
-void* memcpy(void *dest, const void *src, size_t len) {
-    uchar *bdest = (uchar*)dest;
-    uchar *bsrc = (uchar*)src;
+/* below SIMD_THRESHOLD, the setup costs of the vector loops don't pay off. from REP_THRESHOLD on,
+ * "rep movsb/stosb" is faster on CPUs with ERMS (enhanced rep movsb/stosb). from NT_THRESHOLD on,
+ * we use non-temporal stores to not evict the whole cache. */
+#define SIMD_THRESHOLD      128
+#define REP_THRESHOLD       2048
+#define NT_THRESHOLD        (256 * 1024)
+
+#define CPU_SSE2            (1U << 0)
+#define CPU_AVX             (1U << 1)
+#define CPU_ERMS            (1U << 2)
+#define CPU_PROBED          (1U << 31)
+
+/* if the compiler is allowed to use SSE, we have to tell it that we clobber the xmm registers */
+#ifdef __SSE__
+#   define XMM_CLOBBERS     "xmm0", "xmm1", "xmm2", "xmm3",
+#else
+#   define XMM_CLOBBERS
+#endif
+
+static uint cpu_feats = 0;
+
+static void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    *eax = leaf;
+    *ecx = 0;
+    __asm__ __volatile__ ("cpuid" : "+a" (*eax), "=b" (*ebx), "+c" (*ecx), "=d" (*edx));
+}
+
+static uint probe_features(void) {
+    uint32_t max, eax, ebx, ecx, edx;
+    uint feats = CPU_PROBED;
+    cpuid(0, &max, &ebx, &ecx, &edx);
+    if(max >= 1) {
+        cpuid(1, &eax, &ebx, &ecx, &edx);
+        if(edx & (1 << 26))
+            feats |= CPU_SSE2;
+        /* AVX can only be used if the kernel saves the ymm registers, i.e. has enabled XSAVE and
+         * the AVX state in XCR0 */
+        if((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+            uint32_t xcr0, xcr0hi;
+            __asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0hi) : "c" (0));
+            if((xcr0 & 0x6) == 0x6)
+                feats |= CPU_AVX;
+        }
+    }
+    if(max >= 7) {
+        cpuid(7, &eax, &ebx, &ecx, &edx);
+        if(ebx & (1 << 9))
+            feats |= CPU_ERMS;
+    }
+    return feats;
+}
+
+static inline uint cpu_features(void) {
+    /* memcpy and friends are used before any constructor has run. thus, we probe lazily. it doesn't
+     * matter if multiple threads do that at the same time, since they all get the same result. */
+    uint feats = cpu_feats;
+    if(EXPECT_FALSE(feats == 0)) {
+        feats = probe_features();
+        cpu_feats = feats;
+    }
+    return feats;
+}
+
+static void copy_generic(uchar *bdest, const uchar *bsrc, size_t len) {
     // copy bytes for alignment
     if(((uintptr_t)bdest % sizeof(word_t)) == ((uintptr_t)bsrc % sizeof(word_t))) {
         while(len > 0 && (uintptr_t)bdest % sizeof(word_t)) {
@@ -29,7 +91,7 @@ void* memcpy(void *dest, const void *src, size_t len) {
     }
 
     word_t *ddest = (word_t*)bdest;
-    word_t *dsrc = (word_t*)bsrc;
+    const word_t *dsrc = (const word_t*)bsrc;
     // copy words with loop-unrolling
     while(len >= sizeof(word_t) * 8) {
         *ddest = *dsrc;
@@ -53,58 +115,304 @@ void* memcpy(void *dest, const void *src, size_t len) {
 
     // copy remaining bytes
     bdest = (uchar*)ddest;
-    bsrc = (uchar*)dsrc;
+    bsrc = (const uchar*)dsrc;
     while(len-- > 0)
         *bdest++ = *bsrc++;
+}
+
+static void copy_rep(uchar *dest, const uchar *src, size_t len) {
+    __asm__ __volatile__ (
+        "rep movsb"
+        : "+D" (dest), "+S" (src), "+c" (len)
+        :
+        : "memory"
+    );
+}
+
+/* loads 64 bytes from %1 and stores them with the given instruction to %0, which is aligned */
+#define SSE2_COPY_LOOP(STORE)                       \
+    "1:\n\t"                                        \
+    "movdqu     0(%1), %%xmm0\n\t"                  \
+    "movdqu     16(%1), %%xmm1\n\t"                 \
+    "movdqu     32(%1), %%xmm2\n\t"                 \
+    "movdqu     48(%1), %%xmm3\n\t"                 \
+    STORE "     %%xmm0, 0(%0)\n\t"                  \
+    STORE "     %%xmm1, 16(%0)\n\t"                 \
+    STORE "     %%xmm2, 32(%0)\n\t"                 \
+    STORE "     %%xmm3, 48(%0)\n\t"                 \
+    "add        $64, %0\n\t"                        \
+    "add        $64, %1\n\t"                        \
+    "dec        %2\n\t"                             \
+    "jnz        1b\n\t"
+
+static void copy_sse2(uchar *dest, const uchar *src, size_t len, int nt) {
+    // align the destination to 16 bytes
+    size_t head = -(uintptr_t)dest & 15;
+    copy_generic(dest, src, head);
+    dest += head;
+    src += head;
+    len -= head;
+
+    size_t blocks = len / 64;
+    if(blocks) {
+        if(nt) {
+            __asm__ __volatile__ (
+                SSE2_COPY_LOOP("movntdq")
+                "sfence"
+                : "+r" (dest), "+r" (src), "+r" (blocks)
+                :
+                : XMM_CLOBBERS "memory"
+            );
+        }
+        else {
+            __asm__ __volatile__ (
+                SSE2_COPY_LOOP("movdqa")
+                : "+r" (dest), "+r" (src), "+r" (blocks)
+                :
+                : XMM_CLOBBERS "memory"
+            );
+        }
+    }
+    copy_generic(dest, src, len % 64);
+}
+
+static void copy_avx(uchar *dest, const uchar *src, size_t len) {
+    // align the destination to 32 bytes
+    size_t head = -(uintptr_t)dest & 31;
+    copy_generic(dest, src, head);
+    dest += head;
+    src += head;
+    len -= head;
+
+    size_t blocks = len / 128;
+    if(blocks) {
+        __asm__ __volatile__ (
+            "1:\n\t"
+            "vmovdqu    0(%1), %%ymm0\n\t"
+            "vmovdqu    32(%1), %%ymm1\n\t"
+            "vmovdqu    64(%1), %%ymm2\n\t"
+            "vmovdqu    96(%1), %%ymm3\n\t"
+            "vmovdqa    %%ymm0, 0(%0)\n\t"
+            "vmovdqa    %%ymm1, 32(%0)\n\t"
+            "vmovdqa    %%ymm2, 64(%0)\n\t"
+            "vmovdqa    %%ymm3, 96(%0)\n\t"
+            "add        $128, %0\n\t"
+            "add        $128, %1\n\t"
+            "dec        %2\n\t"
+            "jnz        1b\n\t"
+            // avoid the penalty for mixing AVX and legacy SSE code
+            "vzeroupper"
+            : "+r" (dest), "+r" (src), "+r" (blocks)
+            :
+            : XMM_CLOBBERS "memory"
+        );
+    }
+    copy_generic(dest, src, len % 128);
+}
+
+/* copies <len> bytes to a non-overlapping or a lower destination */
+static void copy_forward(uchar *dest, const uchar *src, size_t len) {
+    if(len < SIMD_THRESHOLD) {
+        copy_generic(dest, src, len);
+        return;
+    }
+
+    uint feats = cpu_features();
+    if(len >= NT_THRESHOLD && (feats & CPU_SSE2))
+        copy_sse2(dest, src, len, 1);
+    else if(len >= REP_THRESHOLD && (feats & CPU_ERMS))
+        copy_rep(dest, src, len);
+    else if(feats & CPU_AVX)
+        copy_avx(dest, src, len);
+    else if(feats & CPU_SSE2)
+        copy_sse2(dest, src, len, 0);
+    else
+        copy_generic(dest, src, len);
+}
+
+void* memcpy(void *dest, const void *src, size_t len) {
+    copy_forward((uchar*)dest, (const uchar*)src, len);
     return dest;
 }
 
+static void move_backwards_generic(uchar *dest, const uchar *src, size_t count) {
+    word_t *dsrc = (word_t*)((uintptr_t)src + count - sizeof(word_t));
+    word_t *ddest = (word_t*)((uintptr_t)dest + count - sizeof(word_t));
+    while(count >= sizeof(word_t)) {
+        *ddest-- = *dsrc--;
+        count -= sizeof(word_t);
+    }
+    const uchar *s = (uchar*)dsrc + (sizeof(word_t) - 1);
+    uchar *d = (uchar*)ddest + (sizeof(word_t) - 1);
+    while(count-- > 0)
+        *d-- = *s--;
+}
+
+static void move_backwards_sse2(uchar *dest, const uchar *src, size_t count) {
+    // we read all 64 bytes of a block before we write them. since dest > src, the following reads
+    // will not see the written data
+    size_t blocks = count / 64;
+    uchar *d = dest + count - 64;
+    const uchar *s = src + count - 64;
+    __asm__ __volatile__ (
+        "1:\n\t"
+        "movdqu     0(%1), %%xmm0\n\t"
+        "movdqu     16(%1), %%xmm1\n\t"
+        "movdqu     32(%1), %%xmm2\n\t"
+        "movdqu     48(%1), %%xmm3\n\t"
+        "movdqu     %%xmm0, 0(%0)\n\t"
+        "movdqu     %%xmm1, 16(%0)\n\t"
+        "movdqu     %%xmm2, 32(%0)\n\t"
+        "movdqu     %%xmm3, 48(%0)\n\t"
+        "sub        $64, %0\n\t"
+        "sub        $64, %1\n\t"
+        "dec        %2\n\t"
+        "jnz        1b\n\t"
+        : "+r" (d), "+r" (s), "+r" (blocks)
+        :
+        : XMM_CLOBBERS "memory"
+    );
+    move_backwards_generic(dest, src, count % 64);
+}
+
 void *memmove(void *dest, const void *src, size_t count) {
-    uchar *s, *d;
+    uchar *d = (uchar*)dest;
+    const uchar *s = (const uchar*)src;
     // nothing to do?
-    if((uchar*)dest == (uchar*)src || count == 0)
+    if(d == s || count == 0)
         return dest;
 
-    // moving forward
-    if((uintptr_t)dest > (uintptr_t)src) {
-        word_t *dsrc = (word_t*)((uintptr_t)src + count - sizeof(word_t));
-        word_t *ddest = (word_t*)((uintptr_t)dest + count - sizeof(word_t));
-        while(count >= sizeof(word_t)) {
-            *ddest-- = *dsrc--;
-            count -= sizeof(word_t);
-        }
-        s = (uchar*)dsrc + (sizeof(word_t) - 1);
-        d = (uchar*)ddest + (sizeof(word_t) - 1);
-        while(count-- > 0)
-            *d-- = *s--;
-    }
-    // moving backwards
+    // copying to a lower address or without overlap can be done forwards
+    if((uintptr_t)d < (uintptr_t)s || (uintptr_t)d >= (uintptr_t)s + count)
+        copy_forward(d, s, count);
+    // otherwise we have to start at the end
+    else if(count >= SIMD_THRESHOLD && (cpu_features() & CPU_SSE2))
+        move_backwards_sse2(d, s, count);
     else
-        memcpy(dest, src, count);
-
+        move_backwards_generic(d, s, count);
     return dest;
 }
 
-void *memset(void *addr, int value, size_t count) {
-    uchar *baddr = (uchar*)addr;
+static void set_generic(uchar *baddr, uchar value, size_t count) {
     // align it
     while(count > 0 && (uintptr_t)baddr % sizeof(word_t)) {
         *baddr++ = value;
         count--;
     }
 
-    // set with dwords
-    uint dwval = (value << 24) | (value << 16) | (value << 8) | value;
-    uint *dwaddr = (uint*)baddr;
-    while(count >= sizeof(uint)) {
-        *dwaddr++ = dwval;
-        count -= sizeof(uint);
+    // set with words
+    word_t wval = ((word_t)-1 / 0xFF) * value;
+    word_t *waddr = (word_t*)baddr;
+    while(count >= sizeof(word_t)) {
+        *waddr++ = wval;
+        count -= sizeof(word_t);
     }
 
     // set remaining bytes
-    baddr = (uchar*)dwaddr;
+    baddr = (uchar*)waddr;
     while(count-- > 0)
         *baddr++ = value;
+}
+
+static void set_rep(uchar *addr, uchar value, size_t count) {
+    __asm__ __volatile__ (
+        "rep stosb"
+        : "+D" (addr), "+c" (count)
+        : "a" (value)
+        : "memory"
+    );
+}
+
+/* stores %%xmm0 with the given instruction into the 64 bytes at %0, which is aligned */
+#define SSE2_SET_LOOP(STORE)                        \
+    "movdqa     (%2), %%xmm0\n\t"                   \
+    "1:\n\t"                                        \
+    STORE "     %%xmm0, 0(%0)\n\t"                  \
+    STORE "     %%xmm0, 16(%0)\n\t"                 \
+    STORE "     %%xmm0, 32(%0)\n\t"                 \
+    STORE "     %%xmm0, 48(%0)\n\t"                 \
+    "add        $64, %0\n\t"                        \
+    "dec        %1\n\t"                             \
+    "jnz        1b\n\t"
+
+static void set_sse2(uchar *addr, uchar value, size_t count, int nt) {
+    word_t pattern[16 / sizeof(word_t)] ALIGNED(16);
+    size_t head = -(uintptr_t)addr & 15;
+    set_generic(addr, value, head);
+    addr += head;
+    count -= head;
+
+    size_t blocks = count / 64;
+    if(blocks) {
+        set_generic((uchar*)pattern, value, 16);
+        if(nt) {
+            __asm__ __volatile__ (
+                SSE2_SET_LOOP("movntdq")
+                "sfence"
+                : "+r" (addr), "+r" (blocks)
+                : "r" (pattern)
+                : XMM_CLOBBERS "memory"
+            );
+        }
+        else {
+            __asm__ __volatile__ (
+                SSE2_SET_LOOP("movdqa")
+                : "+r" (addr), "+r" (blocks)
+                : "r" (pattern)
+                : XMM_CLOBBERS "memory"
+            );
+        }
+    }
+    set_generic(addr, value, count % 64);
+}
+
+static void set_avx(uchar *addr, uchar value, size_t count) {
+    word_t pattern[32 / sizeof(word_t)] ALIGNED(32);
+    size_t head = -(uintptr_t)addr & 31;
+    set_generic(addr, value, head);
+    addr += head;
+    count -= head;
+
+    size_t blocks = count / 128;
+    if(blocks) {
+        set_generic((uchar*)pattern, value, 32);
+        __asm__ __volatile__ (
+            "vmovdqa    (%2), %%ymm0\n\t"
+            "1:\n\t"
+            "vmovdqa    %%ymm0, 0(%0)\n\t"
+            "vmovdqa    %%ymm0, 32(%0)\n\t"
+            "vmovdqa    %%ymm0, 64(%0)\n\t"
+            "vmovdqa    %%ymm0, 96(%0)\n\t"
+            "add        $128, %0\n\t"
+            "dec        %1\n\t"
+            "jnz        1b\n\t"
+            "vzeroupper"
+            : "+r" (addr), "+r" (blocks)
+            : "r" (pattern)
+            : XMM_CLOBBERS "memory"
+        );
+    }
+    set_generic(addr, value, count % 128);
+}
+
+void *memset(void *addr, int value, size_t count) {
+    uchar *baddr = (uchar*)addr;
+    if(count < SIMD_THRESHOLD) {
+        set_generic(baddr, value, count);
+        return addr;
+    }
+
+    uint feats = cpu_features();
+    if(count >= NT_THRESHOLD && (feats & CPU_SSE2))
+        set_sse2(baddr, value, count, 1);
+    else if(count >= REP_THRESHOLD && (feats & CPU_ERMS))
+        set_rep(baddr, value, count);
+    else if(feats & CPU_AVX)
+        set_avx(baddr, value, count);
+    else if(feats & CPU_SSE2)
+        set_sse2(baddr, value, count, 0);
+    else
+        set_generic(baddr, value, count);
     return addr;
 }
 
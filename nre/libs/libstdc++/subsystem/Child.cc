@@ -62,6 +62,7 @@ void Child::release_regs() {
         DataSpaceDesc desc = it->desc();
         if(it->cap() != ObjCap::INVALID && desc.type() != DataSpaceDesc::VIRTUAL)
             _cm->_dsm.release(desc, it->cap());
+        _cm->release_copies(&*it);
     }
 }
 
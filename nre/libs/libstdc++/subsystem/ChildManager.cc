@@ -30,7 +30,7 @@ namespace nre {
 ChildManager::ChildManager()
     : _child_count(), _childs(),
       _portal_caps(CapSelSpace::get().allocate(MAX_CHILDS * per_child_caps(), per_child_caps())),
-      _dsm(), _registry(), _sm(), _switchsm(), _slotsm(), _regsm(0), _diesm(0), _ecs(), _regecs() {
+      _dsm(), _registry(), _sm(), _switchsm(), _switchseq(0), _slotsm(), _regsm(0), _diesm(0), _ecs(), _regecs() {
     _ecs = new LocalThread *[CPU::count()];
     _regecs = new LocalThread *[CPU::count()];
     for(auto it = CPU::begin(); it != CPU::end(); ++it) {
@@ -62,7 +62,7 @@ ChildManager::~ChildManager() {
     }
     delete[] _ecs;
     delete[] _regecs;
-    CapSelSpace::get().free(MAX_CHILDS * per_child_caps());
+    CapSelSpace::get().free(_portal_caps, MAX_CHILDS * per_child_caps(), per_child_caps());
     RCU::gc(true);
 }
 
@@ -199,6 +199,7 @@ Child::id_type ChildManager::load(uintptr_t addr, size_t size, const ChildConfig
     size_t idx = free_slot();
     capsel_t pts = _portal_caps + idx * per_child_caps();
     Child *c = new Child(this, pts, config.cmdline());
+    c->reglist().prefault(config.prefault());
     try {
         // we have to create the portals first to be able to delegate them to the new Pd
         c->_ptcount = CPU::count() * (ARRAY_SIZE(exc) + Portals::COUNT - 1);
@@ -249,15 +250,60 @@ Child::id_type ChildManager::load(uintptr_t addr, size_t size, const ChildConfig
             if(ph->p_flags & PF_X)
                 perms |= ChildMemory::X;
 
-            size_t dssize = Math::round_up<size_t>(ph->p_memsz, ExecEnv::PAGE_SIZE);
-            // TODO leak, if reglist().add throws
-            const DataSpace &ds = _dsm.create(
-                DataSpaceDesc(dssize, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RWX));
-            // TODO actually it would be better to do that later
-            memcpy(reinterpret_cast<void*>(ds.virt()),
-                   reinterpret_cast<void*>(addr + ph->p_offset), ph->p_filesz);
-            memset(reinterpret_cast<void*>(ds.virt() + ph->p_filesz), 0, ph->p_memsz - ph->p_filesz);
-            c->reglist().add(ds.desc(), ph->p_vaddr, perms, ds.unmapsel());
+            // if desired, map the segments directly from the ELF file. this requires that the file
+            // offset fits to the page offset of the virtual address
+            size_t shared = 0;
+            uintptr_t pageoff = ph->p_vaddr & (ExecEnv::PAGE_SIZE - 1);
+            if(config.share_segments() &&
+               ((addr + ph->p_offset) & (ExecEnv::PAGE_SIZE - 1)) == pageoff) {
+                // read-only segments can be mapped completely, if there is nothing to zero
+                if(!(ph->p_flags & PF_W)) {
+                    if(ph->p_filesz == ph->p_memsz)
+                        shared = Math::round_up<size_t>(ph->p_memsz + pageoff, ExecEnv::PAGE_SIZE);
+                }
+                // writable segments are copied on the first access, but only the pages that are
+                // completely backed by the file. the rest has to be zero'd
+                else
+                    shared = (ph->p_filesz + pageoff) & ~(ExecEnv::PAGE_SIZE - 1);
+            }
+            if(shared == 0) {
+                size_t dssize = Math::round_up<size_t>(ph->p_memsz, ExecEnv::PAGE_SIZE);
+                // TODO leak, if reglist().add throws
+                const DataSpace &ds = _dsm.create(
+                    DataSpaceDesc(dssize, DataSpaceDesc::ANONYMOUS,
+                                  DataSpaceDesc::RWX | DataSpaceDesc::ZEROED));
+                // TODO actually it would be better to do that later
+                memcpy(reinterpret_cast<void*>(ds.virt()),
+                       reinterpret_cast<void*>(addr + ph->p_offset), ph->p_filesz);
+                if(!(ds.flags() & DataSpaceDesc::ZEROED))
+                    memset(reinterpret_cast<void*>(ds.virt() + ph->p_filesz), 0, ph->p_memsz - ph->p_filesz);
+                c->reglist().add(ds.desc(), ph->p_vaddr, perms, ds.unmapsel());
+                continue;
+            }
+
+            // the memory is not ours, i.e. don't mark it as OWN and don't release it. mark
+            // read-only segments as COW as well, because a page of the file might belong to a
+            // read-only and a writable segment. see Portals::pf()
+            uintptr_t virt = ph->p_vaddr - pageoff;
+            uintptr_t file = addr + ph->p_offset - pageoff;
+            DataSpaceDesc desc(shared, DataSpaceDesc::ANONYMOUS, 0, 0, file);
+            uint flags = (perms & ~ChildMemory::OWN) | ChildMemory::COW;
+            c->reglist().add(desc, virt, flags);
+
+            // copy the last partial page and zero the rest
+            size_t total = Math::round_up<size_t>(ph->p_memsz + pageoff, ExecEnv::PAGE_SIZE);
+            if(total > shared) {
+                size_t filerest = ph->p_filesz + pageoff - shared;
+                // TODO leak, if reglist().add throws
+                const DataSpace &ds = _dsm.create(
+                    DataSpaceDesc(total - shared, DataSpaceDesc::ANONYMOUS,
+                                  DataSpaceDesc::RWX | DataSpaceDesc::ZEROED));
+                memcpy(reinterpret_cast<void*>(ds.virt()),
+                       reinterpret_cast<void*>(file + shared), filerest);
+                if(!(ds.flags() & DataSpaceDesc::ZEROED))
+                    memset(reinterpret_cast<void*>(ds.virt() + filerest), 0, total - shared - filerest);
+                c->reglist().add(ds.desc(), virt + shared, perms, ds.unmapsel());
+            }
         }
 
         // utcb
@@ -680,8 +726,8 @@ void ChildManager::map(UtcbFrameRef &uf, Child *c, DataSpace::RequestType type)
         // create it or attach to the existing dataspace
         const DataSpace &ds = type == DataSpace::JOIN ? _dsm.join(crd.offset()) : _dsm.create(desc);
 
-        // add it to the regions of the child
-        uint flags = ds.flags();
+        // add it to the regions of the child. COW is reserved for the ELF segments we share
+        uint flags = ds.flags() & ~ChildMemory::COW;
         try {
             // only create creations and non-device-memory
             if(type != DataSpace::JOIN && ds.desc().phys() == 0)
@@ -735,6 +781,9 @@ void ChildManager::switch_to(UtcbFrameRef &uf, Child *c) {
         // delegated it and if they cause a pagefault during this operation, we might get mixed
         // results)
         ScopedLock<UserSm> guard_switch(&_switchsm);
+        // pagefaults don't take _switchsm, but check the sequence number instead. thus, make
+        // it odd during the switch to let them wait and retry.
+        ScopedSwitch seq(&_switchseq);
 
         uintptr_t srcorg, dstorg;
         {
@@ -755,7 +804,12 @@ void ChildManager::switch_to(UtcbFrameRef &uf, Child *c) {
                                                                        << dst->desc().size() << ")");
             }
 
-            // first revoke the memory to prevent further accesses
+            // now swap the origins also in the dataspace-manager (otherwise clients that join
+            // afterwards will receive the wrong location). do that first, because it fails if one
+            // of them isn't known and we haven't changed anything yet in this case.
+            _dsm.swap(srcsel, dstsel);
+
+            // revoke the memory to prevent further accesses
             CapRange(src->desc().origin() >> ExecEnv::PAGE_SHIFT,
                      src->desc().size() >> ExecEnv::PAGE_SHIFT, Crd::MEM_ALL).revoke(false);
             CapRange(dst->desc().origin() >> ExecEnv::PAGE_SHIFT,
@@ -807,15 +861,18 @@ void ChildManager::switch_to(UtcbFrameRef &uf, Child *c) {
             }
             x++;
         }
-
-        // now swap the origins also in the dataspace-manager (otherwise clients that join
-        // afterwards will receive the wrong location)
-        _dsm.swap(srcsel, dstsel);
     }
 
     uf << E_SUCCESS;
 }
 
+void ChildManager::release_copies(const ChildMemory::DS *ds) {
+    for(auto it = ds->chunks().cbegin(); it != ds->chunks().cend(); ++it) {
+        DataSpaceDesc desc = it->desc();
+        _dsm.release(desc, it->sel());
+    }
+}
+
 void ChildManager::unmap(UtcbFrameRef &uf, Child *c) {
     capsel_t sel = 0;
     DataSpaceDesc desc;
@@ -831,6 +888,9 @@ void ChildManager::unmap(UtcbFrameRef &uf, Child *c) {
     }
     else {
         LOG(DATASPACES, "Child '" << c->cmdline() << "' destroys " << sel << ": " << desc << "\n");
+        ChildMemory::DS *ds = c->reglist().find(sel);
+        if(ds)
+            release_copies(ds);
         // destroy (decrease refs) the ds
         _dsm.release(desc, sel);
         c->reglist().remove(sel);
@@ -886,94 +946,187 @@ void ChildManager::Portals::pf(capsel_t pid) {
         return;
     }
 
+    // the chunk for copy-on-write pages that we've allocated outside of the lock
+    const DataSpace *chunk = nullptr;
+    size_t chunksize = 0;
+    uint chunkflags = 0;
     try {
         ScopedLock<RCULock> guard(&RCU::lock());
         Child *c = cm->get_child(pid);
-        ScopedLock<UserSm> guard_switch(&cm->_switchsm);
-        ScopedLock<UserSm> guard_regs(&c->_sm);
 
         LOG(PFS, "Child '" << c->cmdline() << "': Pagefault for " << fmt(pfaddr, "p")
                            << " @ " << fmt(eip, "p") << " on cpu " << pcpu << ", error="
                            << fmt(error, "#x") << "\n");
 
-        // TODO different handlers (cow, ...)
-        uintptr_t pfpage = pfaddr & ~(ExecEnv::PAGE_SIZE - 1);
-        bool remap = false;
-        ChildMemory::DS *ds = c->reglist().find_by_addr(pfaddr);
-        uint perms = 0;
-        uint flags = 0;
-        kill = !ds || !ds->desc().flags();
-        if(!kill) {
-            flags = ds->page_perms(pfaddr);
-            perms = ds->desc().flags() & ChildMemory::RWX;
-        }
-        // check if the access rights are violated
-        if(flags) {
-            if((error & 0x2) && !(perms & ChildMemory::W))
-                kill = true;
-            if((error & 0x4) && !(perms & ChildMemory::R))
-                kill = true;
-        }
+        // we don't lock _switchsm here, because that would serialize all pagefaults of all childs.
+        // instead, we remember the switch sequence number and retry if a switch took place while
+        // we've been looking for the mapping. we check it again directly before the delegate,
+        // because switch_to revokes the memory without holding our _sm.
+        while(true) {
+            if(chunksize) {
+                // this is a call to our parent. so, don't hold c->_sm while doing that
+                chunk = &cm->_dsm.create(DataSpaceDesc(chunksize, DataSpaceDesc::ANONYMOUS, chunkflags));
+                chunksize = 0;
+            }
 
-        // is the page already mapped (may be ok if two cpus accessed the page at the same time)
-        if(!kill && flags) {
-            // first check if our parent has unmapped the memory
-            Crd res = Syscalls::lookup(Crd(ds->origin(pfaddr) >> ExecEnv::PAGE_SHIFT, 0, Crd::MEM));
-            // if so, remap it
-            if(res.is_null()) {
-                // reset it here as well. this is necessary for subsystems (where our parent has
-                // revoked the memory)
-                c->_last_fault_addr = 0;
-                c->_last_fault_cpu = 0;
-                // reset all permissions since we want to remap it completely.
-                // note that this assumes that we're revoking always complete dataspaces.
-                ds->all_perms(0);
-                remap = true;
+            size_t seq = cm->switch_seq();
+            ScopedLock<UserSm> guard_regs(&c->_sm);
+
+            uintptr_t pfpage = pfaddr & ~(ExecEnv::PAGE_SIZE - 1);
+            bool remap = false;
+            ChildMemory::DS *ds = c->reglist().find_by_addr(pfaddr);
+            uint perms = 0;
+            uint flags = 0;
+            kill = !ds || !ds->desc().flags();
+            if(!kill) {
+                flags = ds->page_perms(pfaddr);
+                perms = ds->desc().flags() & ChildMemory::RWX;
             }
-            // same fault for same cpu again?
-            else if(pfpage == c->_last_fault_addr && cpu == c->_last_fault_cpu) {
-                LOG(CHILD_KILL, "Child '" << c->cmdline() << "': Caused fault for "
-                                          << fmt(pfaddr, "p") << " on cpu " << pcpu
-                                          << " twice. Giving up :(\n");
-                kill = true;
+            // check if the access rights are violated
+            if(flags) {
+                if((error & 0x2) && !(perms & ChildMemory::W))
+                    kill = true;
+                if((error & 0x4) && !(perms & ChildMemory::R))
+                    kill = true;
+                if((error & 0x10) && !(perms & ChildMemory::X))
+                    kill = true;
             }
-            else {
-                LOG(PFS, "Child '" << c->cmdline() << "': Pagefault for " << fmt(pfaddr, "p")
-                                   << " @ " << fmt(eip, "p") << " on cpu " << pcpu << ", error="
-                                   << fmt(error, "#x") << " (page already mapped)\n");
-                LOG(PFS_DETAIL, "See regionlist:\n" << c->reglist());
-                c->_last_fault_addr = pfpage;
-                c->_last_fault_cpu = cpu;
+
+            Crd res(0);
+            if(!kill && flags)
+                res = Syscalls::lookup(Crd(ds->origin(pfaddr) >> ExecEnv::PAGE_SHIFT, 0, Crd::MEM));
+            // the origin might have changed in the meantime
+            if(cm->switch_seq_changed(seq))
+                continue;
+
+            // write access to a page that has not been copied yet? then copy it and map the copy
+            if(!kill && ds->is_cow() && (error & 0x2) && !ds->copied(pfpage)) {
+                if(!ds->can_copy()) {
+                    if(!chunk) {
+                        // allocate a few pages at once to keep the number of dataspaces small. the
+                        // copies need the same permissions as the dataspace, because we can only
+                        // delegate what we have.
+                        chunksize = ds->chunk_pages() * ExecEnv::PAGE_SIZE;
+                        chunkflags = ds->desc().flags() & DataSpaceDesc::RWX;
+                        continue;
+                    }
+                    ds->add_chunk(chunk->desc(), chunk->unmapsel());
+                    chunk = nullptr;
+                }
+                if(cm->switch_seq_changed(seq))
+                    continue;
+
+                // the shared page might be mapped read-only into this child and others. NOVA doesn't
+                // replace an existing mapping and we can't revoke it from this child only. thus,
+                // revoke it from all; the others will simply fault again (see below).
+                CapRange(ds->origin(pfpage) >> ExecEnv::PAGE_SHIFT, 1, Crd::MEM_ALL).revoke(false);
+                ds->copy(pfpage);
+                CapRange cr(ds->origin(pfpage) >> ExecEnv::PAGE_SHIFT, 1, Crd::MEM | (perms << 2),
+                            pfpage >> ExecEnv::PAGE_SHIFT);
+                ds->page_perms(pfpage, 1, perms);
+                c->reglist().fault_handled(1);
+                uf.delegate(cr);
+                break;
             }
-        }
 
-        if(!kill && (remap || !flags)) {
-            // try to map the next few pages
-            size_t pages = 32;
-            if(ds->desc().flags() & DataSpaceDesc::BIGPAGES) {
-                // try to map the whole pagetable at once
-                pages = ExecEnv::PT_ENTRY_COUNT;
-                // take care that we start at the beginning (note that this assumes that it is
-                // properly aligned, which is made sure by root. otherwise we might leave the ds
-                pfpage &= ~(ExecEnv::BIG_PAGE_SIZE - 1);
+            // is the page already mapped (may be ok if two cpus accessed the page at the same time)
+            if(!kill && flags) {
+                // first check if our parent has unmapped the memory. if so, remap it
+                if(res.is_null()) {
+                    // reset it here as well. this is necessary for subsystems (where our parent has
+                    // revoked the memory)
+                    c->_last_fault_addr = 0;
+                    c->_last_fault_cpu = 0;
+                    // reset all permissions since we want to remap it completely.
+                    // note that this assumes that we're revoking always complete dataspaces.
+                    ds->all_perms(0);
+                    remap = true;
+                }
+                // a shared page that another child has copied (and thus revoked)?
+                else if(ds->is_cow() && !ds->copied(pfpage)) {
+                    ds->page_perms(pfpage, 1, 0);
+                    remap = true;
+                }
+                // same fault for same cpu again?
+                else if(pfpage == c->_last_fault_addr && cpu == c->_last_fault_cpu) {
+                    LOG(CHILD_KILL, "Child '" << c->cmdline() << "': Caused fault for "
+                                              << fmt(pfaddr, "p") << " on cpu " << pcpu
+                                              << " twice. Giving up :(\n");
+                    kill = true;
+                }
+                else {
+                    LOG(PFS, "Child '" << c->cmdline() << "': Pagefault for " << fmt(pfaddr, "p")
+                                       << " @ " << fmt(eip, "p") << " on cpu " << pcpu << ", error="
+                                       << fmt(error, "#x") << " (page already mapped)\n");
+                    LOG(PFS_DETAIL, "See regionlist:\n" << c->reglist());
+                    c->_last_fault_addr = pfpage;
+                    c->_last_fault_cpu = cpu;
+                    c->reglist().fault_handled(0);
+                }
             }
-            uintptr_t src = ds->origin(pfpage);
-            CapRange cr(src >> ExecEnv::PAGE_SHIFT, pages, Crd::MEM | (perms << 2),
-                        pfpage >> ExecEnv::PAGE_SHIFT);
-            // ensure that it fits into the utcb
-            cr.limit_to(uf.free_typed());
-            cr.count(ds->page_perms(pfpage, cr.count(), perms));
-            uf.delegate(cr);
-            // ensure that we have the memory (if we're a subsystem this might not be true)
-            // TODO this is not sufficient, in general
-            // TODO perhaps we could find the dataspace, that belongs to this address and use this
-            // one to notify the parent that he should map it?
-            UNUSED volatile int x = *reinterpret_cast<int*>(src);
+
+            if(!kill && (remap || !flags)) {
+                // try to map the next few pages
+                size_t pages;
+                if(ds->desc().flags() & DataSpaceDesc::HUGE) {
+                    // map the biggest aligned block around the fault at once, so that the kernel
+                    // can use superpages for it
+                    uint maxorder = Math::next_pow2_shift(ExecEnv::HUGE_PAGE_SIZE) - ExecEnv::PAGE_SHIFT;
+                    uint order = ds->max_order(pfpage, maxorder);
+                    pages = static_cast<size_t>(1) << order;
+                    pfpage &= ~((pages << ExecEnv::PAGE_SHIFT) - 1);
+                }
+                else if(ds->desc().flags() & DataSpaceDesc::BIGPAGES) {
+                    // try to map the whole pagetable at once
+                    pages = ExecEnv::PT_ENTRY_COUNT;
+                    // take care that we start at the beginning (note that this assumes that it is
+                    // properly aligned, which is made sure by root. otherwise we might leave the ds
+                    pfpage &= ~(ExecEnv::BIG_PAGE_SIZE - 1);
+                }
+                else
+                    pages = ds->prefault_window(pfpage, c->reglist().prefault());
+                // the pages of writable copy-on-write dataspaces have different origins and shared
+                // pages may only be mapped read-only
+                if(ds->is_cow() && (perms & ChildMemory::W)) {
+                    pages = 1;
+                    if(!ds->copied(pfpage))
+                        perms &= ~ChildMemory::W;
+                }
+                // a switch might have revoked the origin while we've been busy. check it right
+                // before we hand it out, so that we don't map memory that has been switched away
+                if(cm->switch_seq_changed(seq))
+                    continue;
+                uintptr_t src = ds->origin(pfpage);
+                CapRange cr(src >> ExecEnv::PAGE_SHIFT, pages, Crd::MEM | (perms << 2),
+                            pfpage >> ExecEnv::PAGE_SHIFT);
+                // ensure that it fits into the utcb
+                cr.limit_to(uf.free_typed());
+                cr.count(ds->page_perms(pfpage, cr.count(), perms));
+                ds->prefaulted(pfpage + cr.count() * ExecEnv::PAGE_SIZE);
+                c->reglist().fault_handled(cr.count());
+                uf.delegate(cr);
+                // ensure that we have the memory (if we're a subsystem this might not be true)
+                // TODO this is not sufficient, in general
+                // TODO perhaps we could find the dataspace, that belongs to this address and use
+                // this one to notify the parent that he should map it?
+                UNUSED volatile int x = *reinterpret_cast<int*>(src);
+            }
+            break;
         }
     }
     catch(...) {
         kill = true;
     }
+    // we haven't used the chunk (e.g., because another CPU has copied the page in the meantime)?
+    if(chunk) {
+        try {
+            DataSpaceDesc desc = chunk->desc();
+            cm->_dsm.release(desc, chunk->unmapsel());
+        }
+        catch(...) {
+            // ignore it
+        }
+    }
 
     // we can't release the lock after having killed the child. thus, we do out here (it's save
     // because there can't be any running Ecs anyway since we only destroy it when there are no
@@ -31,8 +31,10 @@ OStream &operator<<(OStream &os, const ChildMemory &cm) {
            << ((flags & ChildMemory::R) ? 'r' : '-')
            << ((flags & ChildMemory::W) ? 'w' : '-')
            << ((flags & ChildMemory::X) ? 'x' : '-')
+           << ((flags & ChildMemory::COW) ? 'c' : '-')
            << " <- " << fmt(it->desc().origin(), "p") << "\n";
     }
+    os << "\tPagefaults: " << cm.faults() << " (" << cm.prefaulted() << " pages prefaulted)\n";
     return os;
 }
 
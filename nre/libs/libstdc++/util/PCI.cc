@@ -19,7 +19,7 @@
 
 namespace nre {
 
-Gsi *PCI::get_gsi_msi(BDF bdf, uint nr, void *msix_table) {
+Gsi *PCI::get_gsi_msi(BDF bdf, uint nr, void *msix_table, cpu_t cpu) {
     size_t msix_offset = find_cap(bdf, CAP_MSIX);
     size_t msi_offset = find_cap(bdf, CAP_MSI);
     if(!(msix_offset || msi_offset))
@@ -30,7 +30,7 @@ Gsi *PCI::get_gsi_msi(BDF bdf, uint nr, void *msix_table) {
     DataSpace devds(ExecEnv::PAGE_SIZE, DataSpaceDesc::LOCKED, DataSpaceDesc::R, phys_addr);
 
     // create GSI
-    Gsi *gsi = new Gsi(reinterpret_cast<void*>(devds.virt()), CPU::current().log_id());
+    Gsi *gsi = new Gsi(reinterpret_cast<void*>(devds.virt()), cpu);
     if(!gsi->msi_addr())
         throw PCIException(E_FAILURE, "Attach to MSI failed - IRQs may be broken!");
 
@@ -63,10 +63,10 @@ Gsi *PCI::get_gsi_msi(BDF bdf, uint nr, void *msix_table) {
     return gsi;
 }
 
-Gsi *PCI::get_gsi(BDF bdf, uint nr, bool /*level*/, void *msix_table) {
+Gsi *PCI::get_gsi(BDF bdf, uint nr, bool /*level*/, void *msix_table, cpu_t cpu) {
     // If the device is MSI or MSI-X capable, don't use legacy interrupts.
     if(find_cap(bdf, CAP_MSIX) || find_cap(bdf, CAP_MSI))
-        return get_gsi_msi(bdf, nr, msix_table);
+        return get_gsi_msi(bdf, nr, msix_table, cpu);
 
     // we can't program vector > 0 when we only have legacy interrupts
     assert(nr == 0);
@@ -85,7 +85,7 @@ Gsi *PCI::get_gsi(BDF bdf, uint nr, bool /*level*/, void *msix_table) {
         // No clue which GSI is triggered - fall back to PIC irq
         gsi = conf_read(bdf, 0xf) & 0xff;
     }
-    return new Gsi(gsi, CPU::current().log_id());
+    return new Gsi(gsi, cpu);
 }
 
 size_t PCI::find_cap(BDF bdf, cap_type id) {
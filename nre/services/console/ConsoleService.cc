@@ -41,8 +41,9 @@ void ConsoleService::create_dummy(uint page, const String &title) {
     ConsoleSessionData *sess = static_cast<ConsoleSessionData*>(new_session(Pd::current()->sel()));
     sess->set_page(page);
     DataSpace *ds = new DataSpace(ExecEnv::PAGE_SIZE * Screen::PAGES, DataSpaceDesc::ANONYMOUS,
-                                  DataSpaceDesc::RW);
-    memset(reinterpret_cast<void*>(ds->virt()), 0, ExecEnv::PAGE_SIZE * Screen::PAGES);
+                                  DataSpaceDesc::RW | DataSpaceDesc::ZEROED);
+    if(!(ds->flags() & DataSpaceDesc::ZEROED))
+        memset(reinterpret_cast<void*>(ds->virt()), 0, ExecEnv::PAGE_SIZE * Screen::PAGES);
     memcpy(reinterpret_cast<void*>(ds->virt() + sess->offset()),
            reinterpret_cast<void*>(_screen->mem().virt() + sess->offset()),
            ExecEnv::PAGE_SIZE);
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <kobj/UserSm.h>
+#include <ipc/Producer.h>
 #include <services/Console.h>
 #include <collection/DList.h>
 
@@ -30,7 +30,7 @@ char ViewSwitcher::_backup[Screen::COLS * 2];
 char ViewSwitcher::_buffer[Screen::COLS + 1];
 
 ViewSwitcher::ViewSwitcher(ConsoleService *srv)
-    : _usm(1), _ds(DS_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW), _sm(0),
+    : _ds(DS_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW), _sm(0),
       _prod(_ds, _sm, true), _cons(_ds, _sm, false),
       _ec(GlobalThread::create(switch_thread, CPU::current().log_id(), "console-vs")),
       _srv(srv) {
@@ -42,8 +42,6 @@ void ViewSwitcher::switch_to(ConsoleSessionData *from, ConsoleSessionData *to) {
     cmd.oldsessid = from ? from->id() : -1;
     cmd.sessid = to->id();
     LOG(CONSOLE, "Going to switch from " << cmd.oldsessid << " to " << cmd.sessid << "\n");
-    // we can't access the producer concurrently
-    ScopedLock<UserSm> guard(&_usm);
     _prod.produce(cmd);
 }
 
@@ -137,7 +135,8 @@ void ViewSwitcher::switch_thread(void*) {
 
         // wait 25ms
         LOG(CONSOLE, "Waiting until " << clock.source_time(REFRESH_DELAY) << "\n");
-        timer.wait_until(clock.source_time(REFRESH_DELAY));
+        timer.wait_until(clock.source_time(REFRESH_DELAY),
+                         static_cast<timevalue_t>(Hip::get().freq_tsc) * REFRESH_SLACK);
         LOG(CONSOLE, "Waiting done\n");
     }
 }
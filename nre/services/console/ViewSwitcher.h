@@ -16,8 +16,8 @@
 
 #pragma once
 
-#include <ipc/Producer.h>
-#include <ipc/Consumer.h>
+#include <ipc/MPSCProducer.h>
+#include <ipc/MPSCConsumer.h>
 #include <kobj/GlobalThread.h>
 #include <kobj/Sc.h>
 #include <mem/DataSpace.h>
@@ -32,6 +32,7 @@ class ViewSwitcher {
     static const uint COLOR           = 0x1F;
     static const uint SWITCH_TIME     = 1000; // ms
     static const uint REFRESH_DELAY   = 25;   // ms
+    static const uint REFRESH_SLACK   = 5;    // ms
 
     struct SwitchCommand {
         size_t oldsessid;
@@ -50,11 +51,10 @@ public:
 private:
     static void switch_thread(void*);
 
-    nre::UserSm _usm;
     nre::DataSpace _ds;
     nre::Sm _sm;
-    nre::Producer<SwitchCommand> _prod;
-    nre::Consumer<SwitchCommand> _cons;
+    nre::MPSCProducer<SwitchCommand> _prod;
+    nre::MPSCConsumer<SwitchCommand> _cons;
     nre::GlobalThread *_ec;
     ConsoleService *_srv;
     static char _backup[];
@@ -16,18 +16,86 @@
 
 #include <ipc/Service.h>
 #include <ipc/Consumer.h>
+#include <ipc/MPSCConsumer.h>
+#include <services/Log.h>
 #include <stream/Serial.h>
 #include <kobj/GlobalThread.h>
 #include <kobj/Sc.h>
+#include <util/Atomic.h>
+#include <util/Sync.h>
 #include <String.h>
+#include <CPU.h>
+#include <cstring>
 
 #include "Log.h"
 
 using namespace nre;
 
+/**
+ * A session at the log service. If the client wants to, it gets a ring in shared memory, which is
+ * drained by the drain thread as well.
+ */
+class LogServiceSession : public ServiceSession {
+    static const size_t RING_SIZE   = ExecEnv::PAGE_SIZE * 2;
+
+public:
+    explicit LogServiceSession(Service *s, size_t id, capsel_t cap, capsel_t caps,
+                               Pt::portal_func func)
+        : ServiceSession(s, id, cap, caps, func), _sm(), _ds(), _cons() {
+    }
+    virtual ~LogServiceSession() {
+        delete _cons;
+        delete _ds;
+    }
+
+    MPSCConsumer<LogSession::Line> *cons() {
+        return rcu_dereference(_cons);
+    }
+
+    const DataSpace &share(Sm &sm) {
+        // SHARE might be called on multiple CPUs at once
+        ScopedLock<UserSm> guard(&_sm);
+        if(_ds)
+            throw Exception(E_EXISTS, "Ring does already exist");
+        _ds = new DataSpace(RING_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW);
+        MPSCConsumer<LogSession::Line> *cons = new MPSCConsumer<LogSession::Line>(*_ds, sm, true);
+        // the drain thread might be sleeping already
+        cons->sleeping(true);
+        Sync::memory_barrier();
+        _cons = cons;
+        return *_ds;
+    }
+
+private:
+    UserSm _sm;
+    DataSpace *_ds;
+    MPSCConsumer<LogSession::Line> *_cons;
+};
+
+class LogService : public Service {
+public:
+    typedef SessionIterator<LogServiceSession> iterator;
+
+    explicit LogService(Pt::portal_func portal) : Service("log", CPUSet(CPUSet::ALL), portal) {
+    }
+
+    iterator sessions_begin() {
+        return Service::sessions_begin<LogServiceSession>();
+    }
+    iterator sessions_end() {
+        return Service::sessions_end<LogServiceSession>();
+    }
+
+private:
+    virtual ServiceSession *create_session(size_t id, capsel_t cap, capsel_t caps,
+                                           Pt::portal_func func) {
+        return new LogServiceSession(this, id, cap, caps, func);
+    }
+};
+
 BufferedLog BufferedLog::_inst INIT_PRIO_SERIAL;
 Log Log::_inst INIT_PRIO_SERIAL;
-Service *Log::_srv;
+LogService *Log::_srv;
 const char *Log::_colors[] = {
     "31", "32", "33", "34", "35", "36"
 };
@@ -36,7 +104,9 @@ BufferedLog::BufferedLog() : BaseSerial(), _bufpos(0), _buf() {
     BaseSerial::_inst = this;
 }
 
-Log::Log() : BaseSerial(), _ports(PORT_BASE, 6), _sm(1), _ready(true) {
+Log::Log()
+    : BaseSerial(), _ports(PORT_BASE, 6), _sm(1), _ready(true), _fifo_size(1), _fifo(0),
+      _rings(), _drainsm(), _sleeping(false), _dropped(0) {
     _ports.out<uint8_t>(0x80, LCR);          // Enable DLAB (set baud rate divisor)
     _ports.out<uint8_t>(0x01, DLR_LO);       // Set divisor to 1 (lo byte) 115200 baud
     _ports.out<uint8_t>(0x00, DLR_HI);       //                  (hi byte)
@@ -44,15 +114,132 @@ Log::Log() : BaseSerial(), _ports(PORT_BASE, 6), _sm(1), _ready(true) {
     _ports.out<uint8_t>(0, IER);             // disable interrupts
     _ports.out<uint8_t>(7, FCR);
     _ports.out<uint8_t>(3, MCR);
+    // if the FIFO has been enabled, we can write multiple bytes at once
+    if((_ports.in<uint8_t>(IIR) & 0xC0) == 0xC0)
+        _fifo_size = FIFO_SIZE;
 }
 
 void Log::start() {
-    _srv = new Service("log", CPUSet(CPUSet::ALL), portal);
+    // from now on, lines go into the rings and are written by the drain thread
+    _drainsm = new Sm(0);
+    _rings = new Ring[CPU::count()];
+    _srv = new LogService(portal);
+    GlobalThread::create(drain, CPU::current().log_id(), "root-logdrain")->start();
+
     _srv->start();
 }
 
 void Log::write(uint sessid, const char *line, size_t len) {
-    ScopedLock<UserSm> guard(&_sm);
+    // until the drain thread is running, write to the serial line directly
+    if(!_rings) {
+        ScopedLock<UserSm> guard(&_sm);
+        put(sessid, line, len);
+        return;
+    }
+
+    Ring *r = _rings + CPU::current().log_id();
+    {
+        ScopedLock<UserSm> guard(&r->sm);
+        size_t next = (r->wpos + 1) % RING_SIZE;
+        if(next == r->rpos) {
+            Atomic::add(&r->dropped, 1);
+            return;
+        }
+        Line *l = r->lines + r->wpos;
+        l->sessid = sessid;
+        l->len = Math::min(len, sizeof(l->text));
+        memcpy(l->text, line, l->len);
+        Sync::memory_barrier();
+        r->wpos = next;
+    }
+
+    // the drain thread sets the flag before it checks the rings the last time. so, either it sees
+    // our line or we see the flag.
+    Sync::memory_fence();
+    if(_sleeping)
+        _drainsm->up();
+}
+
+bool Log::has_lines() const {
+    for(size_t i = 0; i < CPU::count(); ++i) {
+        if(_rings[i].rpos != _rings[i].wpos || _rings[i].dropped)
+            return true;
+    }
+
+    ScopedLock<RCULock> guard(&RCU::lock());
+    for(auto it = _srv->sessions_begin(); it != _srv->sessions_end(); ++it) {
+        MPSCConsumer<LogSession::Line> *cons = it->cons();
+        if(cons && cons->has_data())
+            return true;
+    }
+    return false;
+}
+
+void Log::announce_sleeping(bool sleeping) {
+    _sleeping = sleeping;
+    ScopedLock<RCULock> guard(&RCU::lock());
+    for(auto it = _srv->sessions_begin(); it != _srv->sessions_end(); ++it) {
+        MPSCConsumer<LogSession::Line> *cons = it->cons();
+        if(cons)
+            cons->sleeping(sleeping);
+    }
+}
+
+void Log::drain_sessions() {
+    ScopedLock<RCULock> guard(&RCU::lock());
+    for(auto it = _srv->sessions_begin(); it != _srv->sessions_end(); ++it) {
+        MPSCConsumer<LogSession::Line> *cons = it->cons();
+        if(!cons)
+            continue;
+        for(size_t n = 0; n < SESS_LINES && cons->has_data(); ++n) {
+            // the client might have put garbage in there
+            LogSession::Line *l = cons->get();
+            ScopedLock<UserSm> guard(&_sm);
+            put(it->id() + 1, l->text, Math::min(l->len, sizeof(l->text)));
+            cons->next();
+        }
+    }
+}
+
+void Log::drain(void*) {
+    Log &log = Log::get();
+    while(1) {
+        for(size_t i = 0; i < CPU::count(); ++i) {
+            Ring *r = log._rings + i;
+            while(r->rpos != r->wpos) {
+                Line *l = r->lines + r->rpos;
+                {
+                    // somebody might still write directly to the serial line
+                    ScopedLock<UserSm> guard(&log._sm);
+                    log.put(l->sessid, l->text, l->len);
+                }
+                Sync::memory_barrier();
+                r->rpos = (r->rpos + 1) % RING_SIZE;
+            }
+
+            size_t dropped = r->dropped;
+            if(dropped) {
+                Atomic::add(&r->dropped, -dropped);
+                log._dropped += dropped;
+                ScopedLock<UserSm> guard(&log._sm);
+                log << "\e[0;31m[log] dropped " << dropped << " lines on CPU " << i << "\e[0m\n";
+            }
+        }
+
+        log.drain_sessions();
+
+        // announce that we're going to block and check again afterwards. note that we can't
+        // block in a RCU section. but this is no problem, because we are woken up as soon as
+        // there is a new line.
+        log.announce_sleeping(true);
+        Sync::memory_fence();
+        if(!log.has_lines())
+            log._drainsm->zero();
+        log.announce_sleeping(false);
+    }
+}
+
+void Log::put(uint sessid, const char *line, size_t len) {
     *this << "\e[0;" << _colors[sessid % ARRAY_SIZE(_colors)] << "m[" << sessid << "] ";
     for(size_t i = 0; i < len; ++i) {
         char c = line[i];
@@ -64,15 +251,33 @@ void Log::write(uint sessid, const char *line, size_t len) {
 
 void Log::portal(capsel_t pid) {
     ScopedLock<RCULock> guard(&RCU::lock());
-    ServiceSession *sess = _srv->get_session<ServiceSession>(pid);
+    LogServiceSession *sess = _srv->get_session<LogServiceSession>(pid);
     UtcbFrameRef uf;
     try {
-        String line;
-        uf >> line;
-        uf.finish_input();
+        LogSession::Command cmd;
+        uf >> cmd;
+        switch(cmd) {
+            case LogSession::WRITE: {
+                String line;
+                uf >> line;
+                uf.finish_input();
+
+                Log::get().write(sess->id() + 1, line.str(), line.length());
+                uf << E_SUCCESS;
+            }
+            break;
+
+            case LogSession::SHARE: {
+                uf.finish_input();
 
-        Log::get().write(sess->id() + 1, line.str(), line.length());
-        uf << E_SUCCESS;
+                const DataSpace &ds = sess->share(*Log::get()._drainsm);
+                uf.delegate(ds.sel(), 0);
+                // the clients may only notify us. otherwise they could steal our wakeups
+                uf.delegate(Log::get()._drainsm->sel(), 1, UtcbFrame::NONE, Crd::OBJ | Crd::SM_UP);
+                uf << E_SUCCESS;
+            }
+            break;
+        }
     }
     catch(const Exception &e) {
         uf.clear();
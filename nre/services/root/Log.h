@@ -20,12 +20,17 @@
 #include <stream/Serial.h>
 #include <kobj/Ports.h>
 #include <kobj/Sm.h>
+#include <kobj/UserSm.h>
+#include <util/Util.h>
 
 class BufferedLog;
+class LogService;
 
 /**
  * The log implementation that provides a service for child tasks that allows them to print lines
- * to the serial line.
+ * to the serial line. As soon as the service is started, the lines are not written to the serial
+ * line directly anymore, but put into a ring per CPU. A separate thread drains the rings and
+ * writes the lines to the serial line. If a ring is full, the line is dropped and counted.
  */
 class Log : public nre::BaseSerial {
     friend class BufferedLog;
@@ -43,10 +48,38 @@ class Log : public nre::BaseSerial {
         FCR     = 2,    // FIFO control register
         LCR     = 3,    // line control register
         MCR     = 4,    // modem control register
+        LSR     = 5,    // line status register
+        IIR     = 2,    // interrupt identification register
     };
 
     static const uint PORT_BASE     = COM1;
     static const uint ROOT_SESS     = 0;
+    static const size_t FIFO_SIZE   = 16;
+    static const size_t RING_SIZE   = 64;
+    // the number of lines to take from each session per round. the rings are writable for the
+    // clients, so we can't simply drain them until they're empty
+    static const size_t SESS_LINES  = 16;
+
+    struct Line {
+        uint sessid;
+        size_t len;
+        char text[MAX_LINE_LEN + 1];
+    };
+
+    /**
+     * The lines of one CPU. The writers on that CPU are serialized by the semaphore, the drain
+     * thread is the only reader.
+     */
+    struct Ring {
+        explicit Ring() : sm(), rpos(0), wpos(0), dropped(0), lines() {
+        }
+
+        nre::UserSm sm;
+        volatile size_t rpos;
+        volatile size_t wpos;
+        volatile size_t dropped;
+        Line lines[RING_SIZE];
+    };
 
 public:
     /**
@@ -60,10 +93,22 @@ public:
      */
     void start();
 
+    /**
+     * @return the total number of lines that have been dropped because a ring was full
+     */
+    size_t dropped() const {
+        return _dropped;
+    }
+
 private:
     explicit Log();
 
     void write(uint sessid, const char *line, size_t len);
+    void put(uint sessid, const char *line, size_t len);
+    bool has_lines() const;
+    void announce_sleeping(bool sleeping);
+    void drain_sessions();
+    static void drain(void*);
 
     virtual void write(char c) {
         if(c == '\0')
@@ -71,25 +116,36 @@ private:
 
         if(c == '\n')
             write('\r');
-        while((_ports.in<uint8_t>(5) & 0x20) == 0)
-            ;
+        // if the transmitter is empty, we can fill the whole FIFO without polling again
+        if(_fifo == 0) {
+            while((_ports.in<uint8_t>(LSR) & 0x20) == 0)
+                nre::Util::pause();
+            _fifo = _fifo_size;
+        }
         _ports.out<uint8_t>(c, 0);
+        _fifo--;
     }
 
-    // note that we use a portal here instead of shared-memory because dataspace sharing doesn't
-    // work with services living in root. the problem is the translation of caps. the translation
-    // stops as soon as the destination Pd is reached. since stuff in root walks to the
-    // directly to the root-ds-manager and bypasses the childmanager, we receive the cap that is
-    // actually meant for the childmanager in the root-ds-manager. thus, we don't find the dataspace.
-    // to prevent the whole problem, we use a portal which works fine in this case, since its
-    // not performance critical anyway. so, sending a long string doesn't really hurt.
+    // note that dataspaces created by the client can't be shared with services living in root.
+    // the problem is the translation of caps. the translation stops as soon as the destination Pd
+    // is reached. since stuff in root walks to the directly to the root-ds-manager and bypasses
+    // the childmanager, we receive the cap that is actually meant for the childmanager in the
+    // root-ds-manager. thus, we don't find the dataspace. the other way around works, though.
+    // that is, the portal lets the client either send a line or get a ring that we have created
+    // and that we drain together with the per-CPU rings.
     PORTAL static void portal(capsel_t pid);
 
     nre::Ports _ports;
     nre::UserSm _sm;
     bool _ready;
+    size_t _fifo_size;
+    size_t _fifo;
+    Ring *_rings;
+    nre::Sm *_drainsm;
+    volatile bool _sleeping;
+    size_t _dropped;
     static Log _inst;
-    static nre::Service *_srv;
+    static LogService *_srv;
     static const char *_colors[];
 };
 
@@ -14,6 +14,9 @@
  * General Public License version 2 for more details.
  */
 
+#include <kobj/GlobalThread.h>
+#include <kobj/Sc.h>
+#include <util/Clock.h>
 #include <Logging.h>
 
 #include "PhysicalMemory.h"
@@ -25,9 +28,15 @@ using namespace nre;
 PhysicalMemory::MemRegion *PhysicalMemory::MemRegion::_free = nullptr;
 PhysicalMemory::RootDataSpace *PhysicalMemory::RootDataSpace::_free = nullptr;
 size_t PhysicalMemory::_totalsize = 0;
+size_t PhysicalMemory::_zeroing = 0;
+size_t PhysicalMemory::_zerowaiters = 0;
 PhysicalMemory::MemRegion PhysicalMemory::MemRegManager::_initial_regs[64];
 bool PhysicalMemory::MemRegManager::_initial_added = false;
+UserSm PhysicalMemory::_sm INIT_PRIO_PMEM;
+Sm PhysicalMemory::_dirtysm INIT_PRIO_PMEM (0);
+Sm PhysicalMemory::_zerodonesm INIT_PRIO_PMEM (0);
 PhysicalMemory::MemRegManager PhysicalMemory::_mem INIT_PRIO_PMEM;
+PhysicalMemory::MemRegManager PhysicalMemory::_zeroed INIT_PRIO_PMEM;
 DataSpaceManager<PhysicalMemory::RootDataSpace> PhysicalMemory::_dsmng INIT_PRIO_PMEM;
 
 void *PhysicalMemory::MemRegion::operator new(size_t) throw() {
@@ -44,7 +53,14 @@ void *PhysicalMemory::MemRegion::operator new(size_t) throw() {
         // during the calculation of the usable memory, we ran out of regions.
         if(_totalsize == 0)
             throw Exception(E_CAPACITY, "Not enough initial regions");
-        uintptr_t phys = PhysicalMemory::_mem.alloc_safe(ExecEnv::PAGE_SIZE);
+        // note that we're called with PhysicalMemory::_sm held (if it's not the startup)
+        uintptr_t phys;
+        try {
+            phys = PhysicalMemory::_mem.alloc_safe(ExecEnv::PAGE_SIZE);
+        }
+        catch(const RegionManagerException&) {
+            phys = PhysicalMemory::_zeroed.alloc_safe(ExecEnv::PAGE_SIZE);
+        }
         uintptr_t virt = VirtualMemory::phys_to_virt(phys);
         MemRegion *reg = reinterpret_cast<MemRegion*>(virt);
         for(size_t i = 0; i < ExecEnv::PAGE_SIZE / sizeof(MemRegion); ++i) {
@@ -72,6 +88,8 @@ PhysicalMemory::RootDataSpace::RootDataSpace(const DataSpaceDesc &desc)
     uint flags = _desc.flags();
     if(_desc.phys() != 0) {
         _desc.phys(Math::round_dn<uintptr_t>(_desc.phys(), ExecEnv::PAGE_SIZE));
+        // device memory and modules are never zero'd
+        flags &= ~DataSpaceDesc::ZEROED;
         if(!PhysicalMemory::can_map(_desc.phys(), _desc.size(), flags)) {
             VTHROW(DataSpaceException, E_ARGS_INVALID,
                    "Unable to map physical memory " << fmt(_desc.phys(), "p") << ".."
@@ -84,10 +102,34 @@ PhysicalMemory::RootDataSpace::RootDataSpace(const DataSpaceDesc &desc)
     }
     else {
         size_t align = 1UL << (_desc.align() + ExecEnv::PAGE_SHIFT);
+        bool zero = flags & DataSpaceDesc::ZEROED;
+        bool allocated = false;
+        if(flags & DataSpaceDesc::HUGE) {
+            // align it to the biggest superpage that fits into it. if the memory is too
+            // fragmented for that, try the smaller one (if there is one; on x86_32 they are
+            // equal). these attempts are speculative, so don't flush the zero'd memory for them
+            static const size_t pagesizes[] = {ExecEnv::HUGE_PAGE_SIZE, ExecEnv::BIG_PAGE_SIZE};
+            for(size_t i = 0; !allocated && i < ARRAY_SIZE(pagesizes); ++i) {
+                if(_desc.size() < pagesizes[i] || (i > 0 && pagesizes[i] == pagesizes[i - 1]))
+                    continue;
+                size_t hugealign = Math::max(align, pagesizes[i]);
+                uintptr_t phys;
+                if(try_alloc(_desc.size(), hugealign, zero, phys)) {
+                    _desc.phys(phys);
+                    allocated = true;
+                    align = hugealign;
+                }
+            }
+            if(!allocated)
+                flags &= ~DataSpaceDesc::HUGE;
+            // let the parents place it at a virtual address with the same alignment
+            _desc.align(Math::next_pow2_shift(align) - ExecEnv::PAGE_SHIFT);
+        }
         if(align < ExecEnv::BIG_PAGE_SIZE || _desc.size() < ExecEnv::BIG_PAGE_SIZE)
             flags &= ~DataSpaceDesc::BIGPAGES;
 
-        _desc.phys(alloc(_desc.size(), align));
+        if(!allocated)
+            _desc.phys(alloc(_desc.size(), align, zero));
         _desc.origin(_desc.phys());
         _desc.virt(VirtualMemory::phys_to_virt(_desc.phys()));
     }
@@ -144,6 +186,146 @@ void PhysicalMemory::RootDataSpace::revoke_mem(uintptr_t addr, size_t size, bool
     CapRange(start, count, Crd::MEM_ALL).revoke(self);
 }
 
+uintptr_t PhysicalMemory::alloc(size_t size, size_t align, bool zero) {
+    bool dirty;
+    bool waited = false;
+    uintptr_t phys;
+    while(1) {
+        {
+            ScopedLock<UserSm> guard(&_sm);
+            if(waited)
+                _zerowaiters--;
+            if(alloc_from(size, align, zero, dirty, phys))
+                break;
+
+            // the chunk that is zero'd at the moment is in neither pool. so, wait until it's back
+            // before we give up. the zeroing thread doesn't start a new chunk meanwhile
+            if(_zeroing == 0) {
+                // the request might span both pools. thus, give the zero'd memory back and try again
+                LOG(MEM_MAP, "Root: Flushing zero'd memory to allocate " << Bytes(size) << "\n");
+                flush_zeroed();
+                dirty = true;
+                phys = _mem.alloc(size, align);
+                break;
+            }
+            _zerowaiters++;
+        }
+        _zerodonesm.down();
+        waited = true;
+    }
+    // let the zeroing thread continue. it also refills the zero'd pool if we've taken from it
+    if(waited || !dirty)
+        _dirtysm.up();
+
+    // we don't hold the lock here, because the memory is ours now
+    if(zero && dirty)
+        memset(reinterpret_cast<void*>(VirtualMemory::phys_to_virt(phys)), 0, size);
+    return phys;
+}
+
+bool PhysicalMemory::try_alloc(size_t size, size_t align, bool zero, uintptr_t &phys) {
+    bool dirty;
+    {
+        ScopedLock<UserSm> guard(&_sm);
+        if(!alloc_from(size, align, zero, dirty, phys))
+            return false;
+    }
+    if(!dirty)
+        _dirtysm.up();
+    if(zero && dirty)
+        memset(reinterpret_cast<void*>(VirtualMemory::phys_to_virt(phys)), 0, size);
+    return true;
+}
+
+bool PhysicalMemory::alloc_from(size_t size, size_t align, bool zero, bool &dirty, uintptr_t &phys) {
+    // prefer the pool that fits the request, so that we don't waste zero'd memory
+    MemRegManager &first = zero ? _zeroed : _mem;
+    MemRegManager &second = zero ? _mem : _zeroed;
+    try {
+        phys = first.alloc(size, align);
+        dirty = !zero;
+        return true;
+    }
+    catch(const RegionManagerException&) {
+    }
+    try {
+        phys = second.alloc(size, align);
+        dirty = zero;
+        return true;
+    }
+    catch(const RegionManagerException&) {
+    }
+    return false;
+}
+
+void PhysicalMemory::flush_zeroed() {
+    while(_zeroed.begin() != _zeroed.end()) {
+        uintptr_t addr = _zeroed.begin()->addr;
+        size_t count = _zeroed.begin()->size;
+        _zeroed.alloc_at(addr, count);
+        _mem.free(addr, count);
+    }
+    _dirtysm.up();
+}
+
+void PhysicalMemory::free(uintptr_t phys, size_t size) {
+    {
+        ScopedLock<UserSm> guard(&_sm);
+        _mem.free(phys, size);
+    }
+    _dirtysm.up();
+}
+
+size_t PhysicalMemory::take_dirty(uintptr_t &phys) {
+    ScopedLock<UserSm> guard(&_sm);
+    // don't take memory away from somebody that is waiting for it and don't zero more than we need
+    if(_zerowaiters || _zeroed.total_count() >= _totalsize / ZERO_POOL_DIV)
+        return 0;
+    auto it = _mem.begin();
+    if(it == _mem.end())
+        return 0;
+    // take chunks aligned to ZERO_CHUNK to keep the zero'd memory usable for big pages
+    phys = it->addr;
+    size_t size = Math::min<size_t>(it->size, ZERO_CHUNK - (phys & (ZERO_CHUNK - 1)));
+    _mem.alloc_at(phys, size);
+    _zeroing = size;
+    return size;
+}
+
+void PhysicalMemory::zero_thread(void*) {
+    Clock clock(ZERO_PAUSE_FREQ);
+    Sm sm(0);
+    while(1) {
+        uintptr_t phys;
+        size_t size = take_dirty(phys);
+        if(size == 0) {
+            _dirtysm.down();
+            continue;
+        }
+
+        memset(reinterpret_cast<void*>(VirtualMemory::phys_to_virt(phys)), 0, size);
+
+        size_t waiters;
+        {
+            ScopedLock<UserSm> guard(&_sm);
+            _zeroed.free(phys, size);
+            _zeroing = 0;
+            waiters = _zerowaiters;
+        }
+        while(waiters-- > 0)
+            _zerodonesm.up();
+
+        // our priority is not below the one of the others, so sleep a bit to leave them the CPU
+        sm.zero_until(clock.source_time(1));
+    }
+}
+
+void PhysicalMemory::start_zeroing() {
+    // the default priority and a short quantum. the thread throttles itself (see zero_thread)
+    GlobalThread *gt = GlobalThread::create(zero_thread, CPU::current().log_id(), "root-zero");
+    gt->start(Qpd(1, 1000));
+}
+
 void PhysicalMemory::add(uintptr_t addr, size_t size) {
     if(VirtualMemory::alloc_ram(addr, size))
         free(addr, size);
@@ -158,7 +340,7 @@ void PhysicalMemory::map_all() {
         if(it->size)
             Hypervisor::map_mem(it->addr, VirtualMemory::phys_to_virt(it->addr), it->size);
     }
-    _totalsize = _mem.total_count();
+    _totalsize = free_size();
 }
 
 bool PhysicalMemory::can_map(uintptr_t phys, size_t size, uint &flags) {
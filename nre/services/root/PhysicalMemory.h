@@ -18,15 +18,19 @@
 
 #include <kobj/Pt.h>
 #include <kobj/UserSm.h>
+#include <kobj/Sm.h>
 #include <mem/DataSpaceManager.h>
 #include <region/RegionManager.h>
 #include <util/Bytes.h>
+#include <util/ScopedLock.h>
 
 /**
  * Manages all physical memory. At the beginning, it is told what memory is available according
  * to the memory map in the Hip. Afterwards, you can allocate something from that and also free
  * it again. Note that all physical memory is directly mapped to VirtualMemory::RAM_BEGIN. Thus,
  * you can get the virtual address for a physical one by using VirtualMemory::phys_to_virt().
+ * Free memory is zero'd in the background by a low-priority thread and kept in a separate pool so
+ * that requests for zero'd memory can usually be served without touching the memory.
  */
 class PhysicalMemory {
     class RootDataSpace;
@@ -59,9 +63,9 @@ class PhysicalMemory {
             for(auto it = _regs.begin(); it != _regs.end(); ++it) {
                 // it has to be > because we can't free the region here
                 if(it->size > size) {
-                    it->addr += size;
-                    it->size -= size;
-                    return it->addr - size;
+                    uintptr_t addr = it->addr;
+                    set(&*it, addr + size, it->size - size);
+                    return addr;
                 }
             }
             VTHROW(RegionManagerException, E_CAPACITY, "Unable to allocate " << size << " bytes");
@@ -125,24 +129,45 @@ class PhysicalMemory {
     };
 
 public:
+    /**
+     * The amount of memory the zeroing thread takes at once
+     */
+    static const size_t ZERO_CHUNK      = nre::ExecEnv::BIG_PAGE_SIZE;
+    /**
+     * The zeroing thread stops if 1/ZERO_POOL_DIV of the memory is zero'd
+     */
+    static const size_t ZERO_POOL_DIV   = 4;
+    /**
+     * The zeroing thread sleeps 1/ZERO_PAUSE_FREQ seconds after each chunk
+     */
+    static const timevalue_t ZERO_PAUSE_FREQ = 1000;
+
     /**
      * Allocates <size> bytes from the physical memory.
      *
      * @param size the number of bytes to allocate
      * @param align the alignment (in bytes; has to be a power of 2)
+     * @param zero whether the memory has to be zero'd
      */
-    static uintptr_t alloc(size_t size, size_t align = 1) {
-        return _mem.alloc(size, align);
-    }
+    static uintptr_t alloc(size_t size, size_t align = 1, bool zero = false);
+    /**
+     * Like alloc, but gives up if the request doesn't fit into one of the pools. That is, it
+     * neither flushes the zero'd memory nor waits for the zeroing thread.
+     *
+     * @param size the number of bytes to allocate
+     * @param align the alignment (in bytes; has to be a power of 2)
+     * @param zero whether the memory has to be zero'd
+     * @param phys will be set to the address, if successful
+     * @return true if the memory has been allocated
+     */
+    static bool try_alloc(size_t size, size_t align, bool zero, uintptr_t &phys);
     /**
      * Free's the given physical memory
      *
      * @param phys the address
      * @param size the number of bytes
      */
-    static void free(uintptr_t phys, size_t size) {
-        _mem.free(phys, size);
-    }
+    static void free(uintptr_t phys, size_t size);
 
     /**
      * Only for the startup: Add the given memory to the available list
@@ -157,6 +182,10 @@ public:
      * memory from the hypervisor Pd to our Pd.
      */
     static void map_all();
+    /**
+     * Only for the startup: Starts the thread that zeros free memory in the background
+     */
+    static void start_zeroing();
 
     /**
      * @return the total amount of available physical memory (this is constant after startup)
@@ -168,7 +197,15 @@ public:
      * @return the amount of still free physical memory
      */
     static size_t free_size() {
-        return _mem.total_count();
+        nre::ScopedLock<nre::UserSm> guard(&_sm);
+        return _mem.total_count() + _zeroed.total_count() + _zeroing;
+    }
+    /**
+     * @return the amount of free physical memory that has already been zero'd
+     */
+    static size_t zeroed_size() {
+        nre::ScopedLock<nre::UserSm> guard(&_sm);
+        return _zeroed.total_count();
     }
 
     /**
@@ -185,10 +222,21 @@ public:
 
 private:
     static bool can_map(uintptr_t phys, size_t size, uint &flags);
+    static bool alloc_from(size_t size, size_t align, bool zero, bool &dirty, uintptr_t &phys);
+    static void flush_zeroed();
+    static size_t take_dirty(uintptr_t &phys);
+    static void zero_thread(void*);
 
     PhysicalMemory();
 
     static size_t _totalsize;
+    static size_t _zeroing;
+    static size_t _zerowaiters;
+    static nre::UserSm _sm;
+    static nre::Sm _dirtysm;
+    static nre::Sm _zerodonesm;
+    // the free memory that might contain garbage and the free memory that is known to be zero'd
     static MemRegManager _mem;
+    static MemRegManager _zeroed;
     static nre::DataSpaceManager<RootDataSpace> _dsmng;
 };
@@ -248,6 +248,7 @@ int main() {
     mng = new ChildManager();
     GlobalThread::create(log_thread, CPU::current().log_id(), "root-log")->start();
     GlobalThread::create(sysinfo_thread, CPU::current().log_id(), "root-sysinfo")->start();
+    PhysicalMemory::start_zeroing();
 
     // wait until log and sysinfo are registered
     while(mng->registry().find("log") == nullptr || mng->registry().find("sysinfo") == nullptr)
@@ -281,6 +282,8 @@ static void start_childs() {
             Hypervisor::map_mem(it->addr, virt, it->size);
 
             ChildConfig cfg(mod, it->cmdline(), cpus.next()->log_id());
+            // we never unmap the modules. so, the childs can share the segments
+            cfg.share_segments(true);
             mng->load(virt, it->size, cfg);
             if(cfg.last())
                 break;
@@ -17,7 +17,7 @@
 #pragma once
 
 #include <mem/DataSpace.h>
-#include <ipc/Producer.h>
+#include <ipc/MPSCProducer.h>
 #include <services/Storage.h>
 
 /**
@@ -27,7 +27,7 @@ class Controller {
 protected:
     typedef nre::Storage::sector_type sector_type;
     typedef nre::Storage::tag_type tag_type;
-    typedef nre::Producer<nre::Storage::Packet> producer_type;
+    typedef nre::MPSCProducer<nre::Storage::Packet> producer_type;
     typedef nre::DMADescList<nre::Storage::MAX_DMA_DESCS> dma_type;
 
 public:
@@ -96,6 +96,17 @@ public:
     virtual void write(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
                        sector_type sector, const dma_type &dma) = 0;
 
+    /**
+     * Reports the completion of the request with tag <tag> and status <status> via <prod>,
+     * while holding the same lock as the completions of the controller do.
+     *
+     * @param drive the drive number (has to be valid)
+     * @param prod the producer to notify
+     * @param tag the tag to use for the notify
+     * @param status the status to report
+     */
+    virtual void complete(size_t drive, producer_type *prod, tag_type tag, uint status) = 0;
+
 protected:
     uint _id;
 };
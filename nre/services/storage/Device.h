@@ -141,7 +141,7 @@ class Device {
 public:
     typedef nre::Storage::sector_type sector_type;
     typedef nre::Storage::tag_type tag_type;
-    typedef nre::Producer<nre::Storage::Packet> producer_type;
+    typedef nre::MPSCProducer<nre::Storage::Packet> producer_type;
     typedef nre::DMADescList<nre::Storage::MAX_DMA_DESCS> dma_type;
 
     enum Operation {
@@ -252,8 +252,13 @@ public:
         uint16_t : 16;
         uint16_t : 16;
         uint16_t : 16;
-        uint16_t : 16;
-        uint16_t : 16;
+        // maximum queue depth - 1
+        uint16_t queueDepth : 5,
+        : 11;
+        // SATA capabilities
+        uint16_t : 8,
+                 ncq : 1,
+        : 7;
         uint16_t : 16;
         uint16_t : 16;
         uint16_t : 16;
@@ -346,7 +351,7 @@ public:
     size_t sector_size() const {
         return _sector_size;
     }
-    size_t max_requests() const {
+    virtual size_t max_requests() const {
         return (1 << (has_lba48() ? 16 : 8)) - 1;
     }
     const char *name() const {
@@ -383,6 +388,9 @@ protected:
     bool has_dma() const {
         return _info.capabilities.DMA;
     }
+    bool has_ncq() const {
+        return _info.ncq;
+    }
 
     static void devname(char *dst, const char *str, size_t len) {
         for(size_t i = 0; i < len / 2; i++) {
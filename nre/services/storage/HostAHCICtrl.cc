@@ -23,8 +23,8 @@
 
 using namespace nre;
 
-HostAHCICtrl::HostAHCICtrl(uint id, PCI &pci, BDF bdf, Gsi *gsi, bool dmar)
-    : Controller(id), _gsi(gsi), _bdf(bdf), _regs_ds(), _regs_high_ds(), _regs(),
+HostAHCICtrl::HostAHCICtrl(uint id, PCI &pci, BDF bdf, bool dmar, bool perport)
+    : Controller(id), _gsi(), _portgsis(), _bdf(bdf), _regs_ds(), _regs_high_ds(), _regs(),
       _regs_high(0), _portcount(0), _ports() {
     assert(!(~pci.conf_read(_bdf, 1) & 6) && "we need mem-decode and busmaster dma");
     PCI::value_type bar = pci.conf_read(_bdf, 9);
@@ -55,18 +55,58 @@ HostAHCICtrl::HostAHCICtrl(uint id, PCI &pci, BDF bdf, Gsi *gsi, bool dmar)
     for(uint i = 30; _regs_high && i < 32; i++)
         create_ahci_port(i, _regs_high + (i - 30), dmar);
 
+    // use one vector per port, if requested and possible. otherwise, all ports share one
+    if(!perport || !create_port_irqs(pci)) {
+        _gsi = pci.get_gsi(bdf, 0);
+
+        char name[32];
+        OStringStream os(name, sizeof(name));
+        os << "ahci-gsi-" << _gsi->gsi();
+        GlobalThread *gt = GlobalThread::create(gsi_thread, CPU::current().log_id(), name);
+        gt->set_tls<HostAHCICtrl*>(Thread::TLS_PARAM, this);
+        gt->start();
+    }
+
     // clear pending irqs
     _regs->is = _regs->pi;
     // enable IRQs
     _regs->ghc |= 2;
+}
+
+bool HostAHCICtrl::create_port_irqs(PCI &pci) {
+    if(!_regs->pi)
+        return false;
+
+    uint last = Math::bit_scan_reverse(_regs->pi);
+    uint vectors = pci.msix_vectors(_bdf);
+    if(vectors <= last) {
+        LOG(STORAGE, "AHCI: " << vectors << " MSI-X vectors are not enough for "
+                              << (last + 1) << " ports; using a shared IRQ\n");
+        return false;
+    }
+
+    // distribute the ports over the CPUs, so that the completions of different drives are
+    // handled in parallel
+    size_t n = 0;
+    for(uint i = 0; i <= last; i++) {
+        if(!_ports[i])
+            continue;
 
-    // start the gsi thread
-    char name[32];
-    OStringStream os(name, sizeof(name));
-    os << "ahci-gsi-" << _gsi->gsi();
-    GlobalThread *gt = GlobalThread::create(gsi_thread, CPU::current().log_id(), name);
-    gt->set_tls<HostAHCICtrl*>(Thread::TLS_PARAM, this);
-    gt->start();
+        cpu_t cpu = n++ % CPU::count();
+        _portgsis[i] = pci.get_gsi_msi(_bdf, i, nullptr, cpu);
+
+        PortIrq *irq = new PortIrq;
+        irq->ctrl = this;
+        irq->port = i;
+        char name[32];
+        OStringStream os(name, sizeof(name));
+        os << "ahci-port-" << i;
+        GlobalThread *gt = GlobalThread::create(port_thread, cpu, name);
+        gt->set_tls<PortIrq*>(Thread::TLS_PARAM, irq);
+        gt->start();
+        LOG(STORAGE, "AHCI: port " << i << " uses MSI-X vector " << i << " on CPU " << cpu << "\n");
+    }
+    return true;
 }
 
 void HostAHCICtrl::create_ahci_port(uint nr, HostAHCIDevice::Register *portreg, bool dmar) {
@@ -78,8 +118,11 @@ void HostAHCICtrl::create_ahci_port(uint nr, HostAHCIDevice::Register *portreg,
     uint32_t sig = HostAHCIDevice::get_signature(portreg);
     if(sig != HostAHCIDevice::SATA_SIG_NONE) {
         try {
+            // the number of command slots and whether the HBA supports NCQ
+            size_t slots = ((_regs->cap >> 8) & 0x1f) + 1;
+            bool ncq = _regs->cap & (1 << 30);
             _ports[nr] = new HostAHCIDevice(portreg, _id * Storage::MAX_DRIVES + _portcount,
-                                            ((_regs->cap >> 8) & 0x1f) + 1, dmar);
+                                            slots, ncq, dmar);
             _ports[nr]->determine_capacity();
             LOG(STORAGE, *_ports[nr] << "\n");
             _portcount++;
@@ -107,3 +150,16 @@ void HostAHCICtrl::gsi_thread(void*) {
         ha->_regs->is = oldis;
     }
 }
+
+void HostAHCICtrl::port_thread(void*) {
+    PortIrq *irq = Thread::current()->get_tls<PortIrq*>(Thread::TLS_PARAM);
+    HostAHCICtrl *ha = irq->ctrl;
+    uint port = irq->port;
+    while(1) {
+        ha->_portgsis[port]->down();
+
+        ha->_ports[port]->irq();
+        // the bits are write-1-to-clear, so that we don't interfere with the other ports
+        ha->_regs->is = 1 << port;
+    }
+}
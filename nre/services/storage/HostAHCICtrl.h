@@ -32,9 +32,17 @@
  * A simple driver for AHCI.
  *
  * State: testing
- * Features: Ports
+ * Features: Ports, per-port MSI-X vectors and IRQ threads
  */
 class HostAHCICtrl : public Controller {
+    /**
+     * The parameter for the per-port IRQ threads
+     */
+    struct PortIrq {
+        HostAHCICtrl *ctrl;
+        uint port;
+    };
+
     /**
      * The register set of an AHCI controller.
      */
@@ -59,8 +67,21 @@ class HostAHCICtrl : public Controller {
     };
 
 public:
-    explicit HostAHCICtrl(uint id, nre::PCI &pci, nre::BDF bdf, nre::Gsi *gsi, bool dmar);
+    /**
+     * Creates a new AHCI controller
+     *
+     * @param id the controller id
+     * @param pci the PCI helper
+     * @param bdf the device
+     * @param dmar whether DMA remapping is used
+     * @param perport whether each port should get its own MSI-X vector and IRQ thread. the ports
+     *  are distributed over all CPUs. if the controller has not enough MSI-X vectors, all ports
+     *  share one vector and thread.
+     */
+    explicit HostAHCICtrl(uint id, nre::PCI &pci, nre::BDF bdf, bool dmar, bool perport);
     virtual ~HostAHCICtrl() {
+        for(size_t i = 0; i < ARRAY_SIZE(_portgsis); ++i)
+            delete _portgsis[i];
         delete _gsi;
         delete _regs_ds;
         delete _regs_high_ds;
@@ -91,15 +112,22 @@ public:
         assert(_ports[idx(drive)]);
         _ports[idx(drive)]->readwrite(prod, tag, ds, sector, dma, true);
     }
+    virtual void complete(size_t drive, producer_type *prod, tag_type tag, uint status) {
+        assert(_ports[idx(drive)]);
+        _ports[idx(drive)]->complete(prod, tag, status);
+    }
 
 private:
     static size_t idx(size_t drive) {
         return drive % nre::Storage::MAX_DRIVES;
     }
     void create_ahci_port(uint nr, HostAHCIDevice::Register *portreg, bool dmar);
+    bool create_port_irqs(nre::PCI &pci);
     static void gsi_thread(void*);
+    static void port_thread(void*);
 
     nre::Gsi *_gsi;
+    nre::Gsi *_portgsis[32];
     nre::BDF _bdf;
     uint _hostirq;
     nre::DataSpace *_regs_ds;
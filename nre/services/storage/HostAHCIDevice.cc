@@ -63,63 +63,120 @@ void HostAHCIDevice::init() {
     // nothing in progress anymore
     _inprogress = 0;
 
-    // enable irqs
-    _regs->ie = 0xf98000f1;
+    // enable irqs (including the set device bits FIS, which signals finished queued commands)
+    _regs->ie = 0xf98000f9;
     identify_drive(_bufferds);
     //set_features(0x3, 0x46);
     //set_features(0x2, 0);
     //return identify_drive(buffer);
 }
 
-void HostAHCIDevice::readwrite(Producer<Storage::Packet> *prod, Storage::tag_type tag,
+void HostAHCIDevice::flush(MPSCProducer<Storage::Packet> *prod, Storage::tag_type tag) {
+    // FLUSH CACHE is not a queued command. thus, with NCQ we have to wait until all other
+    // commands are finished and may not issue new ones until the flush is finished, too. so,
+    // occupy all slots.
+    size_t slots = use_ncq() ? max_requests() : 1;
+    {
+        ScopedLock<UserSm> guard(&_flushsm);
+        for(size_t i = 0; i < slots; ++i)
+            _slotsm.down();
+    }
+
+    ScopedLock<UserSm> guard(&_sm);
+    ScopedSlot slot(this, alloc_slot(), slots);
+    set_command(has_lba48() ? 0xea : 0xe7, 0, true);
+    start_command(prod, tag, slots);
+    slot.release();
+}
+
+void HostAHCIDevice::readwrite(MPSCProducer<Storage::Packet> *prod, Storage::tag_type tag,
                                const DataSpace &ds, sector_type sector, const dma_type &dma,
                                bool write) {
-    ScopedLock<UserSm> guard(&_sm);
     size_t length = dma.bytecount();
+    size_t count = length / sector_size();
     // invalid offset or size?
-    if(length >> 13) {
+    if(count == 0 || count > (has_lba48() ? 0x10000U : 0x100U)) {
         VTHROW(Exception, E_ARGS_INVALID,
-               "Device " << _id << ": Invalid sector count (" << (length >> 13) << ")");
+               "Device " << _id << ": Invalid sector count (" << count << ")");
     }
-
-    uint8_t command = has_lba48() ? 0x25 : 0xc8;
-    if(write)
-        command = has_lba48() ? 0x35 : 0xca;
-    set_command(command, sector, !write, length >> 13);
-
+    if(dma.count() > MAX_PRD_COUNT)
+        VTHROW(Exception, E_ARGS_INVALID, "Device " << _id << ": Too many DMA descriptors");
     for(auto it = dma.begin(); it != dma.end(); ++it) {
         if(it->offset > ds.size() || it->offset + it->count > ds.size()) {
             VTHROW(Exception, E_ARGS_INVALID,
                    "Device " << _id << ": Invalid offset(" << it->offset <<")/"
                                                << "count(" << it->count << ")");
         }
-        add_dma(ds, it->offset, it->count);
     }
-    start_command(prod, tag);
+
+    // wait for a free slot
+    _slotsm.down();
+
+    ScopedLock<UserSm> guard(&_sm);
+    size_t slot = alloc_slot();
+    // don't leak the slot if we can't issue the command
+    ScopedSlot slotguard(this, slot, 1);
+    bool queued = use_ncq();
+    if(queued) {
+        // the sector count is in the features register and the tag in the count register
+        uint8_t command = write ? COMMAND_WRITE_FPDMA_QUEUED : COMMAND_READ_FPDMA_QUEUED;
+        set_command(command, sector, !write, slot << 3, false, 0, count);
+    }
+    else {
+        uint8_t command = has_lba48() ? 0x25 : 0xc8;
+        if(write)
+            command = has_lba48() ? 0x35 : 0xca;
+        set_command(command, sector, !write, count);
+    }
+
+    for(auto it = dma.begin(); it != dma.end(); ++it)
+        add_dma(ds, it->offset, it->count);
+    start_command(prod, tag, 1, queued);
+    slotguard.release();
 }
 
 void HostAHCIDevice::irq() {
+    ScopedLock<UserSm> guard(&_sm);
     uint32_t is = _regs->is;
 
     // clear interrupt status
     _regs->is = is;
 
-    for(uint done = _inprogress & ~_regs->ci, tag; done; done &= ~(1 << tag)) {
+    // a queued command is finished as soon as the device has cleared its bit in SActive
+    uint32_t busy = _regs->ci | _regs->sact;
+    for(uint done = _inprogress & ~busy, tag; done; done &= ~(1 << tag)) {
         tag = nre::Math::bit_scan_forward(done);
         LOG(STORAGE_DETAIL, "Operation for user " << fmt(_usertags[tag].tag, "x") << " is finished\n");
         if(_usertags[tag].prod)
             _usertags[tag].prod->produce(nre::Storage::Packet(_usertags[tag].tag, 0));
 
         _usertags[tag].tag = ~0;
-        _inprogress &= ~(1 << tag);
+        free_slot(tag);
+        for(size_t i = 0; i < _usertags[tag].slots; ++i)
+            _slotsm.up();
     }
 
     if((_regs->tfd & 1) && (~_regs->tfd & 0x400)) {
         LOG(STORAGE, "command failed with " << fmt(_regs->tfd, "x") << "\n");
+        fail_commands();
         init();
     }
 }
 
+void HostAHCIDevice::fail_commands() {
+    // all commands in flight are lost when resetting the port. so, report them as failed
+    for(uint done = _inprogress, tag; done; done &= ~(1 << tag)) {
+        tag = nre::Math::bit_scan_forward(done);
+        if(_usertags[tag].prod)
+            _usertags[tag].prod->produce(nre::Storage::Packet(_usertags[tag].tag, E_FAILURE));
+
+        _usertags[tag].tag = ~0;
+        free_slot(tag);
+        for(size_t i = 0; i < _usertags[tag].slots; ++i)
+            _slotsm.up();
+    }
+}
+
 void HostAHCIDevice::set_command(uint8_t command, uint64_t sector, bool read, uint count, bool atapi,
                                  uint pmp, uint features) {
     _cl[_tag * CL_DWORDS + 0] = (atapi ? 0x20 : 0) | (read ? 0 : 0x40) | 5 | ((pmp & 0xf) << 12);
@@ -158,30 +215,34 @@ void HostAHCIDevice::add_prd(const nre::DataSpace &ds, uint bytes) {
     p[3] = bytes - 1;
 }
 
-size_t HostAHCIDevice::start_command(nre::Producer<nre::Storage::Packet> *prod, ulong usertag) {
+size_t HostAHCIDevice::start_command(nre::MPSCProducer<nre::Storage::Packet> *prod, ulong usertag,
+                                     size_t slots, bool queued) {
     // remember work in progress commands
-    assert(!(_inprogress & (1 << _tag)));
-    _inprogress |= 1 << _tag;
+    assert(_inprogress & (1 << _tag));
     _usertags[_tag].tag = usertag;
     _usertags[_tag].prod = prod;
+    _usertags[_tag].slots = slots;
 
+    // SActive has to be set before the command is issued
+    if(queued)
+        _regs->sact = 1 << _tag;
     _regs->ci = 1 << _tag;
-    size_t res = _tag;
-    _tag = (_tag + 1) % _max_slots;
-    return res;
+    return _tag;
 }
 
 void HostAHCIDevice::identify_drive(nre::DataSpace &buffer) {
     uint16_t *buf = reinterpret_cast<uint16_t*>(buffer.virt());
     memset(reinterpret_cast<void*>(buffer.virt()), 0, 512);
+    alloc_slot();
     set_command(0xec, 0, true);
     add_prd(buffer, 512);
-    size_t tag = start_command(nullptr, 0);
+    size_t tag = start_command(nullptr, 0, 0);
 
     // there is no IRQ on identify, as this is PIO data-in command
-    if(wait_timeout(&_regs->ci, 1 << tag, 0))
+    uint res = wait_timeout(&_regs->ci, 1 << tag, 0);
+    free_slot(tag);
+    if(res)
         VTHROW(Exception, E_TIMEOUT, "Device " << _id << ": Timeout while waiting on IDENTIFY to finish");
-    _inprogress &= ~(1 << tag);
 
     // we do not support spinup
     // TODO is 0 in qemu!? assert(buf[2] == 0xc837);
@@ -190,11 +251,12 @@ void HostAHCIDevice::identify_drive(nre::DataSpace &buffer) {
 }
 
 uint HostAHCIDevice::set_features(uint features, uint count) {
+    alloc_slot();
     set_command(0xef, 0, false, count, false, 0, features);
-    size_t tag = start_command(nullptr, 0);
+    size_t tag = start_command(nullptr, 0, 0);
 
     // there is no IRQ on set_features, as this is a PIO command
-    check3(wait_timeout(&_regs->ci, 1 << tag, 0));
-    _inprogress &= ~(1 << tag);
-    return 0;
+    uint res = wait_timeout(&_regs->ci, 1 << tag, 0);
+    free_slot(tag);
+    return res;
 }
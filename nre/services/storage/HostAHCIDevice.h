@@ -18,7 +18,7 @@
 #pragma once
 
 #include <mem/DataSpace.h>
-#include <ipc/Producer.h>
+#include <ipc/MPSCProducer.h>
 #include <util/Clock.h>
 #include <Assert.h>
 
@@ -30,7 +30,7 @@
  * A single AHCI port with its command list and receive FIS buffer.
  *
  * State: testing
- * Supports: read-sectors, write-sectors, identify-drive
+ * Supports: read-sectors, write-sectors, identify-drive, NCQ
  * Missing: ATAPI detection
  */
 class HostAHCIDevice : public Device {
@@ -50,9 +50,49 @@ class HostAHCIDevice : public Device {
         DET_PRESENT                   = 0x3,
     };
 
+    enum {
+        COMMAND_READ_FPDMA_QUEUED     = 0x60,
+        COMMAND_WRITE_FPDMA_QUEUED    = 0x61,
+    };
+
     struct UserTag {
-        nre::Producer<nre::Storage::Packet> *prod;
+        nre::MPSCProducer<nre::Storage::Packet> *prod;
         nre::Storage::tag_type tag;
+        // the number of slots to free when the command is finished
+        size_t slots;
+    };
+
+    /**
+     * Gives an allocated slot and the <count> units of _slotsm it occupies back, unless the
+     * command has been started. Has to be destroyed while holding _sm.
+     */
+    class ScopedSlot {
+    public:
+        explicit ScopedSlot(HostAHCIDevice *dev, size_t slot, size_t count)
+            : _dev(dev), _slot(slot), _count(count) {
+        }
+        ~ScopedSlot() {
+            if(_dev) {
+                _dev->free_slot(_slot);
+                for(size_t i = 0; i < _count; ++i)
+                    _dev->_slotsm.up();
+            }
+        }
+
+        /**
+         * The command has been started, i.e. irq() will free the slot.
+         */
+        void release() {
+            _dev = nullptr;
+        }
+
+    private:
+        ScopedSlot(const ScopedSlot&);
+        ScopedSlot& operator=(const ScopedSlot&);
+
+        HostAHCIDevice *_dev;
+        size_t _slot;
+        size_t _count;
     };
 
 public:
@@ -102,8 +142,9 @@ public:
         return port->sig;
     }
 
-    explicit HostAHCIDevice(Register *regs, uint disknr, size_t max_slots, bool dmar)
-        : Device(disknr), _sm(), _regs(regs), _clock(FREQ), _max_slots(max_slots), _dmar(dmar),
+    explicit HostAHCIDevice(Register *regs, uint disknr, size_t max_slots, bool ncq, bool dmar)
+        : Device(disknr), _sm(), _slotsm(0), _flushsm(), _regs(regs), _clock(FREQ),
+          _max_slots(max_slots), _hostncq(ncq), _dmar(dmar),
           _bufferds(512, nre::DataSpaceDesc::ANONYMOUS, nre::DataSpaceDesc::RW),
           _clds(max_slots * CL_DWORDS * 4, nre::DataSpaceDesc::ANONYMOUS, nre::DataSpaceDesc::RW),
           _ctds(max_slots * (32 + MAX_PRD_COUNT * 4) * 4,
@@ -114,6 +155,9 @@ public:
           _fis(reinterpret_cast<uint32_t*>(_fisds.virt())),
           _tag(0), _usertags(), _inprogress() {
         init();
+        // now we know how many commands we can have in flight
+        for(size_t i = 0; i < max_requests(); ++i)
+            _slotsm.up();
     }
 
     virtual const char *type() const {
@@ -122,25 +166,58 @@ public:
     virtual void determine_capacity() {
         _capacity = has_lba48() ? _info.lba48MaxLBA : _info.userSectorCount;
     }
+    /**
+     * @return the number of commands that can be in flight at once. without NCQ, this is the
+     *  number of command slots, because the HBA processes them one by one. with NCQ, it's the
+     *  minimum of the command slots and the queue depth of the device.
+     */
+    virtual size_t max_requests() const {
+        if(use_ncq())
+            return nre::Math::min<size_t>(_max_slots, _info.queueDepth + 1);
+        return _max_slots;
+    }
 
-    void flush(nre::Producer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag) {
+    void flush(nre::MPSCProducer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag);
+    void readwrite(nre::MPSCProducer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag,
+                   const nre::DataSpace &ds, sector_type sector, const dma_type &dma, bool write);
+    void complete(nre::MPSCProducer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag,
+                  uint status) {
         nre::ScopedLock<nre::UserSm> guard(&_sm);
-        set_command(has_lba48() ? 0xea : 0xe7, 0, true);
-        start_command(prod, tag);
+        prod->produce(nre::Storage::Packet(tag, status));
     }
-    void readwrite(nre::Producer<nre::Storage::Packet> *prod, nre::Storage::tag_type tag,
-                   const nre::DataSpace &ds, sector_type sector, const dma_type &dma, bool write);
     void irq();
 
     void debug() {
         auto &ser = nre::Serial::get();
         ser << "AHCI is " << nre::fmt(_regs->is, "#x") << " ci " << nre::fmt(_regs->ci, "#x")
             << " ie " << nre::fmt(_regs->ie, "#x") << " cmd " << nre::fmt(_regs->cmd, "#x")
-            << " tfd " << nre::fmt(_regs->tfd, "#x") << " tag " << nre::fmt(_tag, "#x")
-            << "\n";
+            << " tfd " << nre::fmt(_regs->tfd, "#x") << " sact " << nre::fmt(_regs->sact, "#x")
+            << " tag " << nre::fmt(_tag, "#x") << "\n";
     }
 
 private:
+    bool use_ncq() const {
+        return _hostncq && has_ncq() && has_lba48();
+    }
+
+    /**
+     * Allocates a free command slot and makes it the current one. The caller has to hold _sm and
+     * has to make sure that there is a free slot.
+     */
+    size_t alloc_slot() {
+        uint32_t free = ~_inprogress & slot_mask();
+        assert(free != 0);
+        _tag = nre::Math::bit_scan_forward(free);
+        _inprogress |= 1 << _tag;
+        return _tag;
+    }
+    void free_slot(size_t tag) {
+        _inprogress &= ~(1 << tag);
+    }
+    uint32_t slot_mask() const {
+        return _max_slots == 32 ? ~0U : (1U << _max_slots) - 1;
+    }
+
     uint32_t wait_timeout(volatile uint32_t *reg, uint32_t mask, uint32_t value) {
         timevalue_t timeout = _clock.source_time(TIMEOUT);
         while(((*reg & mask) != value) && _clock.source_time() < timeout)
@@ -164,14 +241,20 @@ private:
                      uint pmp = 0, uint features = 0);
     void add_dma(const nre::DataSpace &ds, size_t offset, uint count);
     void add_prd(const nre::DataSpace &ds, uint count);
-    size_t start_command(nre::Producer<nre::Storage::Packet> *prod, ulong usertag);
+    size_t start_command(nre::MPSCProducer<nre::Storage::Packet> *prod, ulong usertag,
+                         size_t slots = 1, bool queued = false);
+    void fail_commands();
     void identify_drive(nre::DataSpace &buffer);
     uint set_features(uint features, uint count = 0);
 
     nre::UserSm _sm;
+    // counts the free slots, i.e. the commands that can be issued without waiting
+    nre::UserSm _slotsm;
+    nre::UserSm _flushsm;
     Register volatile *_regs;
     nre::Clock _clock;
     size_t _max_slots;
+    bool _hostncq;
     bool _dmar;
     nre::DataSpace _bufferds;
     nre::DataSpace _clds;
@@ -182,5 +265,6 @@ private:
     uint32_t *_fis;
     size_t _tag;
     UserTag _usertags[32];
-    uint _inprogress;
+    // the bitmap of used command slots
+    uint32_t _inprogress;
 };
@@ -78,6 +78,11 @@ void HostIDECtrl::flush(size_t drive, producer_type *prod, tag_type tag) {
     prod->produce(nre::Storage::Packet(tag, 0));
 }
 
+void HostIDECtrl::complete(size_t, producer_type *prod, tag_type tag, uint status) {
+    nre::ScopedLock<nre::UserSm> guard(&_sm);
+    prod->produce(nre::Storage::Packet(tag, status));
+}
+
 HostATADevice *HostIDECtrl::detect_drive(uint id) {
     HostATADevice *dev;
     try {
@@ -30,7 +30,7 @@ class HostATADevice;
 
 class HostIDECtrl : public Controller {
     struct UserTag {
-        nre::Producer<nre::Storage::Packet> *prod;
+        nre::MPSCProducer<nre::Storage::Packet> *prod;
         nre::Storage::tag_type tag;
         bool dma;
     };
@@ -63,6 +63,7 @@ public:
                       sector_type sector, const dma_type &dma);
     virtual void write(size_t drive, producer_type *prod, tag_type tag, const nre::DataSpace &ds,
                        sector_type sector, const dma_type &dma);
+    virtual void complete(size_t drive, producer_type *prod, tag_type tag, uint status);
 
     /**
      * @return whether DMA should and can be used
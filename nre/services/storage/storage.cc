@@ -15,10 +15,14 @@
  */
 
 #include <kobj/Sm.h>
+#include <kobj/GlobalThread.h>
 #include <ipc/Producer.h>
+#include <ipc/Consumer.h>
+#include <ipc/MPSCProducer.h>
 #include <services/PCIConfig.h>
 #include <services/ACPI.h>
 #include <util/PCI.h>
+#include <stream/OStringStream.h>
 #include <Logging.h>
 #include <cstring>
 
@@ -37,13 +41,25 @@ class StorageServiceSession : public ServiceSession {
 public:
     explicit StorageServiceSession(Service *s, size_t id, capsel_t cap, capsel_t caps,
                                    Pt::portal_func func)
-        : ServiceSession(s, id, cap, caps, func), _ctrlds(), _sm(), _prod(), _datads(), _drive() {
+        : ServiceSession(s, id, cap, caps, func), _ctrlds(), _sm(), _prod(), _datads(), _subds(),
+          _subsm(), _subcons(), _subdone(0), _drive() {
     }
     virtual ~StorageServiceSession() {
         delete _ctrlds;
         delete _sm;
         delete _prod;
         delete _datads;
+        delete _subcons;
+        delete _subsm;
+        delete _subds;
+    }
+
+    virtual void invalidate() {
+        // stop the submission thread and wait until it's done, because it uses this session
+        if(_subcons) {
+            _subcons->stop();
+            _subdone.down();
+        }
     }
 
     bool initialized() const {
@@ -61,11 +77,11 @@ public:
     const Storage::Parameter &params() const {
         return _params;
     }
-    Producer<Storage::Packet> *prod() {
+    MPSCProducer<Storage::Packet> *prod() {
         return _prod;
     }
 
-    void init(DataSpace *ctrlds, DataSpace *data, Sm *sm, size_t drive) {
+    void init(DataSpace *ctrlds, DataSpace *data, Sm *sm, DataSpace *subds, Sm *subsm, size_t drive) {
         size_t ctrl = drive / Storage::MAX_DRIVES;
         if(!mng->exists(ctrl) || !mng->get(ctrl)->exists(drive)) {
             VTHROW(Exception, E_ARGS_INVALID,
@@ -75,17 +91,41 @@ public:
             throw Exception(E_EXISTS, "Already initialized");
         _ctrlds = ctrlds;
         _sm = sm;
-        _prod = new Producer<Storage::Packet>(*_ctrlds, *_sm, false);
+        _prod = new MPSCProducer<Storage::Packet>(*_ctrlds, *_sm, false);
         _datads = data;
         _drive = drive;
         mng->get(ctrl)->get_params(_drive, &_params);
+
+        // start a thread on the client's CPU that drains the submission ring
+        _subds = subds;
+        _subsm = subsm;
+        _subcons = new Consumer<Storage::Request>(*_subds, *_subsm, false);
+        char name[32];
+        OStringStream os(name, sizeof(name));
+        os << "storage-sub-" << id();
+        GlobalThread *gt = GlobalThread::create(submitter, CPU::current().log_id(), name);
+        gt->set_tls<StorageServiceSession*>(Thread::TLS_PARAM, this);
+        gt->start();
     }
 
+    void flush(Storage::tag_type tag);
+    void complete(Storage::tag_type tag, uint status) {
+        mng->get(ctrl())->complete(drive(), prod(), tag, status);
+    }
+    void readwrite(Storage::Command cmd, Storage::tag_type tag, Storage::sector_type sector,
+                   const Storage::dma_type &dma);
+
 private:
+    static void submitter(void*);
+
     DataSpace *_ctrlds;
     Sm *_sm;
-    Producer<Storage::Packet> *_prod;
+    MPSCProducer<Storage::Packet> *_prod;
     DataSpace *_datads;
+    DataSpace *_subds;
+    Sm *_subsm;
+    Consumer<Storage::Request> *_subcons;
+    Sm _subdone;
     size_t _drive;
     Storage::Parameter _params;
 };
@@ -94,11 +134,12 @@ class StorageService : public Service {
 public:
     explicit StorageService(const char *name)
         : Service(name, CPUSet(CPUSet::ALL), portal) {
-        // we want to accept two dataspaces
+        // we want to accept five caps: two dataspaces and a semaphore for the completions and
+        // a dataspace and a semaphore for the submissions
         for(auto it = CPU::begin(); it != CPU::end(); ++it) {
             LocalThread *ec = get_thread(it->log_id());
             UtcbFrameRef uf(ec->utcb());
-            uf.accept_delegates(2);
+            uf.accept_delegates(3);
         }
     }
 
@@ -111,6 +152,100 @@ private:
     PORTAL static void portal(capsel_t pid);
 };
 
+void StorageServiceSession::flush(Storage::tag_type tag) {
+    if(!initialized())
+        throw Exception(E_ARGS_INVALID, "Not initialized");
+
+    LOG(STORAGE_DETAIL, "[" << id() << "," << fmt(tag, "#x") << "] FLUSH\n");
+    mng->get(ctrl())->flush(drive(), prod(), tag);
+}
+
+void StorageServiceSession::readwrite(Storage::Command cmd, Storage::tag_type tag,
+                                      Storage::sector_type sector, const Storage::dma_type &dma) {
+    if(!initialized())
+        throw Exception(E_ARGS_INVALID, "Not initialized");
+
+    LOG(STORAGE_DETAIL, "[" << id() << "," << fmt(tag, "#x") << "] "
+                            << (cmd == Storage::READ ? "READ" : "WRITE") << " @ " << sector
+                            << " with " << dma << "\n");
+
+    // check offset and size
+    size_t size = dma.bytecount();
+    size_t count = size / params().sector_size;
+    if(size == 0 || (size & (params().sector_size - 1)))
+        VTHROW(Exception, E_ARGS_INVALID, "Invalid size (" << size << ")");
+    if(sector >= params().sectors) {
+        VTHROW(Exception, E_ARGS_INVALID,
+               "Sector " << sector << " is invalid"
+                         << " (available: 0.." << params().sectors - 1 << ")");
+    }
+    if(sector + count > params().sectors) {
+        VTHROW(Exception, E_ARGS_INVALID,
+               "Sector " << (sector + count - 1) << " is invalid"
+                         << " (available: 0.." << params().sectors - 1 << ")");
+    }
+
+    if(cmd == Storage::READ) {
+        if(!(data().flags() & DataSpaceDesc::R))
+            throw Exception(E_ARGS_INVALID, "Need to read, but no read permission");
+        mng->get(ctrl())->read(drive(), prod(), tag, data(), sector, dma);
+    }
+    else {
+        if(!(data().flags() & DataSpaceDesc::W))
+            throw Exception(E_ARGS_INVALID, "Need to write, but no write permission");
+        mng->get(ctrl())->write(drive(), prod(), tag, data(), sector, dma);
+    }
+}
+
+void StorageServiceSession::submitter(void*) {
+    StorageServiceSession *sess =
+        Thread::current()->get_tls<StorageServiceSession*>(Thread::TLS_PARAM);
+    Consumer<Storage::Request> *cons = sess->_subcons;
+    // note that the session is not destroyed until we're done (see invalidate()). this way, we
+    // don't have to stay in a RCU read section while blocking on the semaphore.
+    for(Storage::Request *r; (r = cons->get()) != nullptr; ) {
+        // the ring is writable for the client. so, copy the request first and release the slot.
+        // rebuild the descriptor list instead of taking the client's count and total as they are
+        Storage::Request req;
+        req.cmd = r->cmd;
+        req.tag = r->tag;
+        req.sector = r->sector;
+        size_t count = r->dma.count();
+        if(count <= Storage::MAX_DMA_DESCS) {
+            for(size_t i = 0; i < count; ++i)
+                req.dma.push(r->dma.begin()[i]);
+        }
+        cons->next();
+
+        try {
+            if(count > Storage::MAX_DMA_DESCS)
+                VTHROW(Exception, E_ARGS_INVALID, "Too many DMA descriptors (" << count << ")");
+            switch(req.cmd) {
+                case Storage::FLUSH:
+                    sess->flush(req.tag);
+                    break;
+
+                case Storage::READ:
+                case Storage::WRITE:
+                    sess->readwrite(req.cmd, req.tag, req.sector, req.dma);
+                    break;
+
+                default:
+                    VTHROW(Exception, E_ARGS_INVALID, "Invalid command " << req.cmd);
+                    break;
+            }
+        }
+        catch(const Exception &e) {
+            LOG(STORAGE, "[" << sess->id() << "," << fmt(req.tag, "#x") << "] failed: "
+                             << e.msg() << "\n");
+            // report the error via the completion. the controller produces into the same ring
+            // from its IRQ threads, so do that while holding its lock
+            sess->complete(req.tag, e.code());
+        }
+    }
+    sess->_subdone.up();
+}
+
 void StorageService::portal(capsel_t pid) {
     ScopedLock<RCULock> guard(&RCU::lock());
     StorageServiceSession *sess = srv->get_session<StorageServiceSession>(pid);
@@ -123,10 +258,13 @@ void StorageService::portal(capsel_t pid) {
                 capsel_t ctrlsel = uf.get_delegated(0).offset();
                 capsel_t datasel = uf.get_delegated(0).offset();
                 capsel_t smsel = uf.get_delegated(0).offset();
+                capsel_t subsel = uf.get_delegated(0).offset();
+                capsel_t subsmsel = uf.get_delegated(0).offset();
                 size_t drive;
                 uf >> drive;
                 uf.finish_input();
-                sess->init(new DataSpace(ctrlsel), new DataSpace(datasel), new Sm(smsel, false), drive);
+                sess->init(new DataSpace(ctrlsel), new DataSpace(datasel), new Sm(smsel, false),
+                           new DataSpace(subsel), new Sm(subsmsel, false), drive);
                 uf.accept_delegates();
                 uf << E_SUCCESS << sess->params();
             }
@@ -136,8 +274,7 @@ void StorageService::portal(capsel_t pid) {
                 Storage::tag_type tag;
                 uf >> tag;
                 uf.finish_input();
-                LOG(STORAGE_DETAIL, "[" << sess->id() << "," << fmt(tag, "#x") << "] FLUSH\n");
-                mng->get(sess->ctrl())->flush(sess->drive(), sess->prod(), tag);
+                sess->flush(tag);
                 uf << E_SUCCESS;
             }
             break;
@@ -146,45 +283,10 @@ void StorageService::portal(capsel_t pid) {
             case Storage::WRITE: {
                 Storage::tag_type tag;
                 Storage::sector_type sector;
-                DMADescList<Storage::MAX_DMA_DESCS> dma;
+                Storage::dma_type dma;
                 uf >> tag >> sector >> dma;
                 uf.finish_input();
-
-                if(!sess->initialized())
-                    throw Exception(E_ARGS_INVALID, "Not initialized");
-
-                LOG(STORAGE_DETAIL, "[" << sess->id() << "," << fmt(tag, "#x") << "] "
-                                        << (cmd == Storage::READ ? "READ" : "WRITE") << " @ " << sector
-                                        << " with " << dma << "\n");
-
-                // check offset and size
-                size_t size = dma.bytecount();
-                size_t count = size / sess->params().sector_size;
-                if(size == 0 || (size & (sess->params().sector_size - 1)))
-                    VTHROW(Exception, E_ARGS_INVALID, "Invalid size (" << size << ")");
-                if(sector >= sess->params().sectors) {
-                    VTHROW(Exception, E_ARGS_INVALID,
-                           "Sector " << sector << " is invalid"
-                                     << " (available: 0.." << sess->params().sectors - 1 << ")");
-                }
-                if(sector + count > sess->params().sectors) {
-                    VTHROW(Exception, E_ARGS_INVALID,
-                           "Sector " << (sector + count - 1) << " is invalid"
-                                     << " (available: 0.." << sess->params().sectors - 1 << ")");
-                }
-
-                if(cmd == Storage::READ) {
-                    if(!(sess->data().flags() & DataSpaceDesc::R))
-                        throw Exception(E_ARGS_INVALID, "Need to read, but no read permission");
-                    mng->get(sess->ctrl())->read(sess->drive(), sess->prod(), tag,
-                                                 sess->data(), sector, dma);
-                }
-                else {
-                    if(!(sess->data().flags() & DataSpaceDesc::W))
-                        throw Exception(E_ARGS_INVALID, "Need to write, but no write permission");
-                    mng->get(sess->ctrl())->write(sess->drive(), sess->prod(), tag, sess->data(), sector,
-                                                  dma);
-                }
+                sess->readwrite(cmd, tag, sector, dma);
                 uf << E_SUCCESS;
             }
             break;
@@ -199,14 +301,19 @@ void StorageService::portal(capsel_t pid) {
 
 int main(int argc, char *argv[]) {
     bool idedma = true;
+    bool ahciperport = false;
     for(int i = 1; i < argc; ++i) {
         if(strcmp(argv[i], "noidedma") == 0) {
             LOG(STORAGE, "Disabling DMA for IDE devices\n");
             idedma = false;
         }
+        else if(strcmp(argv[i], "ahciperport") == 0) {
+            LOG(STORAGE, "Using one IRQ thread per AHCI port\n");
+            ahciperport = true;
+        }
     }
 
-    mng = new ControllerMng(idedma);
+    mng = new ControllerMng(idedma, ahciperport);
     srv = new StorageService("storage");
     srv->start();
     return 0;
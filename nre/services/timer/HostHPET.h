@@ -83,8 +83,8 @@ class HostHPET : public HostTimerDevice {
         explicit HPETTimer() : Timer(), _no(), _gsi(), _reg() {
         }
 
-        virtual nre::Gsi &gsi() {
-            return *_gsi;
+        virtual void wait() {
+            _gsi->down();
         }
         virtual void init(HostTimerDevice &dev, cpu_t cpu);
         virtual void program_timeout(timevalue_t next) {
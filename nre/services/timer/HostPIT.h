@@ -33,8 +33,8 @@ class HostPIT : public HostTimerDevice {
         explicit PitTimer() : Timer(), _gsi(irq_to_gsi(IRQ)) {
         }
 
-        virtual nre::Gsi &gsi() {
-            return _gsi;
+        virtual void wait() {
+            _gsi.down();
         }
         virtual void init(HostTimerDevice &, cpu_t) {
         }
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2012, Nils Asmussen <nils@os.inf.tu-dresden.de>
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of NRE (NOVA runtime environment).
+ *
+ * NRE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NRE is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <kobj/Sm.h>
+#include <util/Atomic.h>
+#include <util/Util.h>
+#include <Hip.h>
+#include <CPU.h>
+
+#include "HostTimerDevice.h"
+
+/**
+ * A timer device that uses the TSC as counter and provides one timer per CPU. The timers use
+ * semaphore-downs with timeout, i.e. the kernel programs the local APIC timer (or the TSC
+ * deadline) of the CPU. Thus, no CPU depends on other CPUs to get its timer interrupts.
+ * Note that this requires a TSC that is synchronized between all CPUs.
+ */
+class HostTSC : public HostTimerDevice {
+    class TSCTimer : public Timer {
+    public:
+        explicit TSCTimer() : Timer(), _dev(), _sm(), _deadline(~0ULL) {
+        }
+        virtual ~TSCTimer() {
+            delete _sm;
+        }
+
+        virtual void wait() {
+            while(1) {
+                timevalue_t deadline = nre::Atomic::read_uninterruptible(_deadline);
+                if(deadline == ~0ULL)
+                    _sm->zero();
+                else {
+                    timevalue_t tsc = _dev->to_tsc(deadline);
+                    if(tsc <= nre::Util::tsc() || !_sm->zero_until(tsc))
+                        return;
+                }
+                // we've been woken up because of a new deadline. so, wait again.
+            }
+        }
+        virtual void init(HostTimerDevice &dev, cpu_t) {
+            _dev = static_cast<HostTSC*>(&dev);
+            _sm = new nre::Sm(0);
+        }
+        virtual void program_timeout(timevalue_t next) {
+            // the gsi thread reads it concurrently, so make sure that it never sees a torn value
+            timevalue_t old = nre::Atomic::read_uninterruptible(_deadline);
+            nre::Atomic::write_uninterruptible(_deadline, next);
+            // if the new one is earlier, wake up the waiting thread to let it wait for the new one
+            if(next < old)
+                _sm->up();
+        }
+
+    private:
+        HostTSC *_dev;
+        nre::Sm *_sm;
+        volatile timevalue_t _deadline;
+    };
+
+public:
+    explicit HostTSC()
+        : HostTimerDevice(), _freq(static_cast<timevalue_t>(nre::Hip::get().freq_tsc) * 1000),
+          _offset(), _last(), _timers(new TSCTimer[nre::CPU::count()]) {
+    }
+    virtual ~HostTSC() {
+        delete[] _timers;
+    }
+
+    virtual timevalue_t last_ticks() {
+        return nre::Atomic::read_uninterruptible(_last);
+    }
+    virtual timevalue_t current_ticks() {
+        return nre::Util::tsc() + _offset;
+    }
+    virtual timevalue_t update_ticks(bool) {
+        timevalue_t ticks = current_ticks();
+        nre::Atomic::write_uninterruptible(_last, ticks);
+        return ticks;
+    }
+
+    virtual bool is_periodic() const {
+        return false;
+    }
+    virtual size_t timer_count() const {
+        return nre::CPU::count();
+    }
+    virtual Timer *timer(size_t i) {
+        return _timers + i;
+    }
+    virtual timevalue_t freq() const {
+        return _freq;
+    }
+
+    virtual bool is_in_past(timevalue_t ticks) const {
+        return to_tsc(ticks) <= nre::Util::tsc();
+    }
+    virtual timevalue_t next_timeout(timevalue_t, timevalue_t next) {
+        return next;
+    }
+    virtual void start(timevalue_t ticks) {
+        // the TSC can't be set. so, remember the difference
+        _offset = ticks - nre::Util::tsc();
+        _last = ticks;
+    }
+    virtual void enable(Timer *, bool) {
+        // nothing to do
+    }
+
+private:
+    timevalue_t to_tsc(timevalue_t ticks) const {
+        return ticks - _offset;
+    }
+
+    timevalue_t _freq;
+    timevalue_t _offset;
+    volatile timevalue_t _last;
+    TSCTimer *_timers;
+};
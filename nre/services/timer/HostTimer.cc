@@ -20,24 +20,40 @@
 #include <stream/Serial.h>
 #include <util/Date.h>
 #include <util/Topology.h>
+#include <util/ScopedLock.h>
 #include <Logging.h>
 
 #include "HostTimer.h"
 #include "HostHPET.h"
 #include "HostPIT.h"
+#include "HostTSC.h"
 
 using namespace nre;
 
 void HostTimer::ClientData::init(size_t _sid, cpu_t cpuno, HostTimer::PerCpu *per_cpu) {
     sm = new nre::Sm(0);
-    nr = per_cpu->abstimeouts.alloc(this);
+    {
+        ScopedLock<UserSm> guard(&per_cpu->sm);
+        nr = per_cpu->abstimeouts.alloc(this);
+    }
     cpu = cpuno;
     sid = _sid;
 }
 
-HostTimer::HostTimer(bool force_pit, bool force_hpet_legacy, bool slow_rtc)
-    : _clocks_per_tick(0), _timer(), _rtc(), _clock(Timer::WALLCLOCK_FREQ), _per_cpu(), _xcpu_up(0) {
-    if(!force_pit) {
+void HostTimer::ClientData::release(HostTimer::PerCpu *per_cpu) {
+    ScopedLock<UserSm> guard(&per_cpu->sm);
+    per_cpu->abstimeouts.dealloc(nr, true);
+    // requests that are still in flight are ignored from now on (see per_cpu_client_request)
+    nr = 0;
+}
+
+HostTimer::HostTimer(bool force_pit, bool force_hpet_legacy, bool slow_rtc, bool use_tsc)
+    : _clocks_per_tick(0), _timer(), _rtc(), _clock(Timer::WALLCLOCK_FREQ),
+      _timeds(ExecEnv::PAGE_SIZE, DataSpaceDesc::ANONYMOUS, DataSpaceDesc::RW), _per_cpu(),
+      _xcpu_up(0) {
+    if(use_tsc)
+        _timer = new HostTSC();
+    else if(!force_pit) {
         try {
             _timer = new HostHPET(force_hpet_legacy);
         }
@@ -45,7 +61,7 @@ HostTimer::HostTimer(bool force_pit, bool force_hpet_legacy, bool slow_rtc)
             Serial::get() << "TIMER: HPET initialization failed: " << e.msg() << "\n";
         }
     }
-    if(force_pit || !_timer)
+    if(!_timer)
         _timer = new HostPIT(1000);
 
     // HPET: Counter is running, IRQs are off.
@@ -66,6 +82,9 @@ HostTimer::HostTimer(bool force_pit, bool force_hpet_legacy, bool slow_rtc)
     LOG(TIMER, "TIMER: date: " << date << "\n");
 
     _timer->start(Math::muldiv128(msecs, _timer->freq(), Timer::WALLCLOCK_FREQ));
+    time_info()->seq = 0;
+    time_info()->tsc_freq = _clock.source_freq();
+    update_time(true);
 
     // Initialize per cpu data structure
     _per_cpu = new PerCpu *[CPU::count()];
@@ -173,6 +192,9 @@ next:
 
 bool HostTimer::per_cpu_client_request(PerCpu *per_cpu, ClientData *data) {
     unsigned nr = data->nr;
+    // the session has been closed in the meantime?
+    if(nr == 0)
+        return false;
     per_cpu->abstimeouts.cancel(nr);
 
     timevalue_t t = absolute_tsc_to_timer(data->abstimeout);
@@ -183,16 +205,57 @@ bool HostTimer::per_cpu_client_request(PerCpu *per_cpu, ClientData *data) {
         data->sm->up();
         return false;
     }
+    if(data->slack)
+        t = coalesce(per_cpu, t, data->slack);
     per_cpu->abstimeouts.request(nr, t);
     return (t < per_cpu->last_to);
 }
 
+timevalue_t HostTimer::coalesce(PerCpu *per_cpu, timevalue_t t, timevalue_t slack) {
+    // if the timer will fire within the window anyway, or another timeout is within the window,
+    // fire it with that one
+    if(per_cpu->last_to >= t && per_cpu->last_to - t <= slack)
+        return per_cpu->last_to;
+    timevalue_t next = per_cpu->abstimeouts.timeout();
+    if(next >= t && next - t <= slack)
+        return next;
+
+    // otherwise, round up to a multiple of the largest power of two within the window. this way,
+    // timeouts with overlapping windows tend to end up at the same point in time
+    timevalue_t align = 1;
+    while(align <= slack / 2)
+        align <<= 1;
+    return (t + slack) & ~(align - 1);
+}
+
+void HostTimer::update_time(bool force) {
+    Timer::TimeInfo *info = time_info();
+    word_t seq = info->seq;
+    // the TSC drifts against the timer. but it's sufficient to resync it once per second
+    if(!force && Util::tsc() - info->tsc < _clock.source_freq())
+        return;
+    // if somebody else is updating it at the moment, we're done
+    if((seq & 1) || !Atomic::cmpnswap(&info->seq, seq, seq + 1))
+        return;
+    Sync::memory_barrier();
+
+    info->tsc = Util::tsc();
+    info->unixts = Math::muldiv128(_timer->current_ticks(), Timer::WALLCLOCK_FREQ, _timer->freq());
+
+    Sync::memory_barrier();
+    info->seq = seq + 2;
+}
+
 // Returns the next timeout.
 timevalue_t HostTimer::handle_expired_timers(PerCpu *per_cpu, timevalue_t now) {
     ClientData *data;
     uint nr;
+    bool first = true;
     while((nr = per_cpu->abstimeouts.trigger(now, &data))) {
         assert(data);
+        if(!first)
+            per_cpu->coalesced++;
+        first = false;
         per_cpu->abstimeouts.cancel(nr);
         Atomic::add(&data->count, 1U);
         data->sm->up();
@@ -209,6 +272,7 @@ void HostTimer::portal_per_cpu(capsel_t) {
     WorkerMessage m;
     uf >> m;
     bool reprogram = false;
+    ScopedLock<UserSm> guard(&per_cpu->sm);
 
     // We jump here if we were to late with timer
     // programming. reprogram stays true.
@@ -223,6 +287,7 @@ again:
         case WorkerMessage::TIMER_IRQ: {
             timevalue_t now = ht->_timer->update_ticks(false);
             ht->handle_expired_timers(per_cpu, now);
+            ht->update_time(false);
             reprogram = true;
             break;
         }
@@ -242,6 +307,7 @@ again:
     per_cpu->last_to = next_to;
 
     if(per_cpu->has_timer) {
+        per_cpu->reprograms++;
         per_cpu->timer->program_timeout(next_to);
         // Check whether we might have missed that interrupt.
         if(ht->_timer->is_in_past(next_to)) {
@@ -256,6 +322,7 @@ again:
             return;
 
         // XXX Needs to be written atomically!
+        per_cpu->reprograms++;
         per_cpu->remote_slot->data.abstimeout = next_to;
         Sync::memory_barrier();
         per_cpu->remote_sm->up();
@@ -287,9 +354,9 @@ NORETURN void HostTimer::gsi_thread(void *) {
     WorkerMessage m;
     m.type = WorkerMessage::TIMER_IRQ;
     m.data = nullptr;
-    LOG(TIMER, "Listening to GSI " << our->timer->gsi().gsi() << "\n");
+    LOG(TIMER, "Listening to timer on CPU " << cpu << "\n");
     while(1) {
-        our->timer->gsi().down();
+        our->timer->wait();
 
         ht->_timer->ack_irq(our->timer);
         UtcbFrame uf;
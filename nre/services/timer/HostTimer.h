@@ -21,6 +21,8 @@
 #include <kobj/LocalThread.h>
 #include <kobj/Pt.h>
 #include <kobj/Sm.h>
+#include <kobj/UserSm.h>
+#include <ipc/Service.h>
 #include <services/Timer.h>
 #include <util/TimeoutList.h>
 
@@ -31,7 +33,8 @@ class HostTimer {
     struct PerCpu;
 
 public:
-    static const size_t MAX_CLIENTS = 64;
+    // one entry per session, one per CPU for the cross-CPU timeouts and entry 0 is reserved
+    static const size_t MAX_CLIENTS = nre::Service::MAX_SESSIONS + nre::Hip::MAX_CPUS + 1;
     // Resolution of our TSC clocks per HPET clock measurement. Lower
     // resolution mean larger error in HPET counter estimation.
     static const uint CPT_RES           = /* 1 divided by */ (1U << 13); /* clocks per hpet tick */
@@ -41,6 +44,8 @@ public:
         // belongs to a client it contains an absolute TSC value. If it
         // belongs to a remote CPU it contains an absolute timer count.
         volatile timevalue_t abstimeout;
+        // How much later the timeout may fire (in timer ticks). Only used for clients.
+        timevalue_t slack;
 
         // How often has the timeout triggered?
         volatile uint count;
@@ -50,10 +55,11 @@ public:
         nre::Sm *sm;
         size_t sid;
 
-        explicit ClientData() : abstimeout(0), count(0), nr(0), cpu(0), sm(0), sid() {
+        explicit ClientData() : abstimeout(0), slack(0), count(0), nr(0), cpu(0), sm(0), sid() {
         }
 
         void init(size_t sid, cpu_t cpu, HostTimer::PerCpu *per_cpu);
+        void release(HostTimer::PerCpu *per_cpu);
     };
 
 private:
@@ -73,7 +79,9 @@ private:
     struct PerCpu {
         bool has_timer;
         HostTimerDevice::Timer *timer;
-        nre::TimeoutList<MAX_CLIENTS, ClientData> abstimeouts;
+        nre::TimeoutList<MAX_CLIENTS, ClientData, nre::TimeoutHeap<MAX_CLIENTS> > abstimeouts;
+        // protects abstimeouts against release_clientdata, which is called from other CPUs
+        nre::UserSm sm;
 
         nre::LocalThread *ec;
         nre::Pt worker_pt;
@@ -88,22 +96,31 @@ private:
         RemoteSlot *slots; // Array
         size_t slot_count; // with this many entries
 
+        // Statistics
+        uint64_t reprograms;
+        uint64_t coalesced;
+
         explicit PerCpu(HostTimer *ht, cpu_t cpu)
-            : has_timer(false), timer(0), abstimeouts(), ec(nre::LocalThread::create(cpu)),
+            : has_timer(false), timer(0), abstimeouts(), sm(), ec(nre::LocalThread::create(cpu)),
               worker_pt(ec, portal_per_cpu), xcpu_sm(0), last_to(~0ULL), remote_sm(),
-              remote_slot(), slots(), slot_count() {
+              remote_slot(), slots(), slot_count(), reprograms(), coalesced() {
             ec->set_tls(nre::Thread::TLS_PARAM, ht);
         }
     };
 
 public:
-    explicit HostTimer(bool force_pit = false, bool force_hpet_legacy = false, bool slow_rtc = false);
+    explicit HostTimer(bool force_pit = false, bool force_hpet_legacy = false, bool slow_rtc = false,
+                       bool use_tsc = false);
 
     void setup_clientdata(size_t sid, ClientData *data, cpu_t cpu) {
         data->init(sid, cpu, _per_cpu[cpu]);
     }
+    void release_clientdata(ClientData *data) {
+        data->release(_per_cpu[data->cpu]);
+    }
 
-    void program_timer(ClientData *data, timevalue_t time) {
+    void program_timer(ClientData *data, timevalue_t time, timevalue_t slack) {
+        data->slack = nre::Math::muldiv128(slack, CPT_RES, _clocks_per_tick);
         data->abstimeout = time;
         nre::UtcbFrame uf;
         WorkerMessage m;
@@ -119,6 +136,21 @@ public:
         unixts = nre::Math::muldiv128(ticks, nre::Timer::WALLCLOCK_FREQ, _timer->freq());
     }
 
+    void get_stats(uint64_t &reprograms, uint64_t &coalesced) const {
+        reprograms = coalesced = 0;
+        for(auto it = nre::CPU::begin(); it != nre::CPU::end(); ++it) {
+            reprograms += _per_cpu[it->log_id()]->reprograms;
+            coalesced += _per_cpu[it->log_id()]->coalesced;
+        }
+    }
+
+    /**
+     * @return the dataspace that contains the time page (Timer::TimeInfo)
+     */
+    const nre::DataSpace &time_ds() const {
+        return _timeds;
+    }
+
 private:
     /**
      * Convert an absolute TSC value into an absolute time counter value. Call only from
@@ -132,8 +164,14 @@ private:
         return diff + _timer->current_ticks();
     }
 
+    nre::Timer::TimeInfo *time_info() {
+        return reinterpret_cast<nre::Timer::TimeInfo*>(_timeds.virt());
+    }
+    void update_time(bool force);
+
     bool per_cpu_handle_xcpu(PerCpu *per_cpu);
     bool per_cpu_client_request(PerCpu *per_cpu, ClientData *data);
+    timevalue_t coalesce(PerCpu *per_cpu, timevalue_t t, timevalue_t slack);
     timevalue_t handle_expired_timers(PerCpu *per_cpu, timevalue_t now);
 
     PORTAL static void portal_per_cpu(capsel_t pid);
@@ -144,6 +182,7 @@ private:
     HostTimerDevice *_timer;
     HostRTC _rtc;
     nre::Clock _clock;
+    nre::DataSpace _timeds;
     PerCpu **_per_cpu;
     nre::Sm _xcpu_up;
 };
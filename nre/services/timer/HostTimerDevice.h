@@ -28,7 +28,10 @@ public:
         virtual ~Timer() {
         }
 
-        virtual nre::Gsi &gsi() = 0;
+        /**
+         * Blocks until the timer fires
+         */
+        virtual void wait() = 0;
         virtual void init(HostTimerDevice &dev, cpu_t cpu) = 0;
         virtual void program_timeout(timevalue_t next) = 0;
     };
@@ -35,9 +35,18 @@ public:
             timer->setup_clientdata(id, _data + it->log_id(), it->log_id());
     }
     virtual ~TimerSessionData() {
+        for(auto it = CPU::begin(); it != CPU::end(); ++it)
+            delete _data[it->log_id()].sm;
         delete[] _data;
     }
 
+    virtual void invalidate() {
+        // the session is deleted later, but the workers must not touch it anymore. thus, cancel
+        // and free our timeouts now
+        for(auto it = CPU::begin(); it != CPU::end(); ++it)
+            timer->release_clientdata(_data + it->log_id());
+    }
+
     HostTimer::ClientData *data(cpu_t cpu) {
         return _data + cpu;
     }
@@ -77,8 +86,8 @@ PORTAL static void portal_timer(capsel_t pid) {
                 break;
 
             case nre::Timer::PROG_TIMER: {
-                timevalue_t time;
-                uf >> time;
+                timevalue_t time, slack;
+                uf >> time >> slack;
                 uf.finish_input();
 
                 LOG(TIMER_DETAIL, "TIMER: (" << sess->id() << ") Programming for "
@@ -88,7 +97,7 @@ PORTAL static void portal_timer(capsel_t pid) {
                 LOG(TIMER_DETAIL, "TIMER: (" << sess->id() << ") Programming for "
                                              << fmt(time, "#x") << " on "
                                              << CPU::current().log_id() << "\n");
-                timer->program_timer(sess->data(CPU::current().log_id()), time);
+                timer->program_timer(sess->data(CPU::current().log_id()), time, slack);
                 uf << E_SUCCESS;
             }
             break;
@@ -104,6 +113,22 @@ PORTAL static void portal_timer(capsel_t pid) {
                 uf << E_SUCCESS << uptime << unixts;
             }
             break;
+
+            case nre::Timer::GET_STATS: {
+                uf.finish_input();
+
+                uint64_t reprograms, coalesced;
+                timer->get_stats(reprograms, coalesced);
+                uf << E_SUCCESS << reprograms << coalesced;
+            }
+            break;
+
+            case nre::Timer::GET_TIME_DS:
+                uf.finish_input();
+
+                uf.delegate(timer->time_ds().crd(DataSpaceDesc::R), 0);
+                uf << E_SUCCESS;
+                break;
         }
     }
     catch(const Exception &e) {
@@ -116,6 +141,7 @@ int main(int argc, char *argv[]) {
     bool forcepit = false;
     bool forcehpetlegacy = false;
     bool slowrtc = false;
+    bool tsc = false;
     for(int i = 1; i < argc; ++i) {
         if(strcmp(argv[i], "forcepit") == 0)
             forcepit = true;
@@ -123,9 +149,11 @@ int main(int argc, char *argv[]) {
             forcehpetlegacy = true;
         if(strcmp(argv[i], "slowrtc") == 0)
             slowrtc = true;
+        if(strcmp(argv[i], "tsc") == 0)
+            tsc = true;
     }
 
-    timer = new HostTimer(forcepit, forcehpetlegacy, slowrtc);
+    timer = new HostTimer(forcepit, forcehpetlegacy, slowrtc, tsc);
     srv = new TimerService("timer", portal_timer);
     srv->start();
     return 0;